@@ -1,13 +1,13 @@
 #include "pch.h"
 #include "Decoder.h"
 #include <vector>
-#include <unordered_map>
 #include <memory>
 #include "decoding_machine.h"
+#include "handle_registry.h"
+#include "thread_pool.h"
 
 
-static std::unordered_map<size_t, std::unique_ptr<decoding_machine>> decoders;
-static size_t next_handle = 0;
+static handle_registry<decoding_machine> decoders;
 
 std::vector<BYTE> g_data;
 size_t d_size;
@@ -15,37 +15,105 @@ size_t d_size;
 
 size_t create_decoder()
 {
-    decoders[next_handle] = std::make_unique<decoding_machine>();
-    return next_handle++;
+    return decoders.add(std::make_unique<decoding_machine>());
 }
 
 void destroy_decoder(size_t handle)
 {
-    decoders.erase(handle);
+    decoders.remove(handle);
 }
 
 void decode_from_file(size_t handle, const char* filename)
 {
-    decoders[handle]->feed_data_from_file(std::string{ filename });
+    decoders.get(handle)->feed_data_from_file(std::string{ filename });
 }
 
 void decode_file_to_file(size_t handle, const char* source_file, const char* destination_file)
 {
-    decoders[handle]->feed_data_from_file(std::string{ source_file });
-    decoders[handle]->save_to_file(std::string{ destination_file });
+    decoders.get(handle)->feed_data_from_file(std::string{ source_file });
+    decoders.get(handle)->save_to_file(std::string{ destination_file });
 }
 
 size_t get_decoded_bits_count(size_t handle)
 {
-    return decoders[handle]->get_decoded_bits_count();
+    return decoders.get(handle)->get_decoded_bits_count();
 }
 
 void get_decoded_data(size_t handle, BYTE* data_buf)
 {
-    auto decoded_data = decoders[handle]->get_decoded_data();
-    for (size_t i = 0; i < decoded_data.size(); ++i)
-    {
-        data_buf[i] = decoded_data[i];
-    }
+    decoding_machine* decoder = decoders.get(handle);
+    decoder->write_decoded(data_buf, decoder->get_decoded_size());
 }
 
+size_t get_decoded_data_size(size_t handle)
+{
+    return decoders.get(handle)->get_decoded_size();
+}
+
+void get_decoder_statistics(size_t handle, coding_statistics* statistics)
+{
+    *statistics = decoders.get(handle)->get_statistics();
+}
+
+void feed_borrowed_data_to_decoder(size_t handle, const BYTE* data, size_t data_size)
+{
+    decoders.get(handle)->feed_data(data, data_size);
+}
+
+size_t decode_to_buffer(size_t handle, BYTE* data_buf, size_t data_size)
+{
+    return decoders.get(handle)->write_decoded(data_buf, data_size);
+}
+
+void set_decoder_threads_count(size_t handle, unsigned int threads_count)
+{
+    decoders.get(handle)->set_threads_count(threads_count);
+}
+
+void decode_batch(const BYTE* const* encoded, const size_t* encoded_sizes, size_t encoded_count,
+    BYTE* const* decoded, const size_t* decoded_capacities, size_t* decoded_sizes)
+{
+    thread_pool::get_shared().run_ranges(encoded_count, [&](size_t first, size_t last) {
+        decoding_machine machine;
+        for (size_t i = first; i < last; ++i)
+        {
+            machine.feed_data(encoded[i], encoded_sizes[i]);
+            decoded_sizes[i] = machine.write_decoded(decoded[i], decoded_capacities[i]);
+        }
+    });
+}
+
+size_t get_decoded_samples_count(size_t handle)
+{
+    return decoders.get(handle)->get_sample_count();
+}
+
+void decode_range(size_t handle, size_t first_sample, size_t count, BYTE* data_buf)
+{
+    decoders.get(handle)->decode_range(first_sample, count, data_buf);
+}
+
+void start_decoding_stream(size_t handle)
+{
+    decoders.get(handle)->start_stream();
+}
+
+void push_data_to_decoder(size_t handle, const BYTE* data, size_t data_size)
+{
+    decoders.get(handle)->push_data(data, data_size);
+}
+
+void finish_decoding_stream(size_t handle)
+{
+    decoders.get(handle)->finish_stream();
+}
+
+size_t read_decoded_bytes(size_t handle, BYTE* data_buf, size_t data_size)
+{
+    return decoders.get(handle)->read_stream_bytes(data_buf, data_size);
+}
+
+bool is_decoding_stream_done(size_t handle)
+{
+    return decoders.get(handle)->is_stream_done();
+}
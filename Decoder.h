@@ -1,11 +1,8 @@
 #pragma once
+#include <cstddef>
 #include "Byte.h"
-
-#ifdef MATHLIBRARY_EXPORTS
-#define ENCODER_API __declspec(dllexport)
-#else
-#define ENCODER_API __declspec(dllimport)
-#endif
+#include "export.h"
+#include "coding_statistics.h"
 
 extern "C" ENCODER_API size_t create_decoder();
 extern "C" ENCODER_API void destroy_decoder(size_t handle);
@@ -13,3 +10,44 @@ extern "C" ENCODER_API void decode_from_file(size_t handle, const char* filename
 extern "C" ENCODER_API void decode_file_to_file(size_t handle, const char* source_file, const char* destination_file);
 extern "C" ENCODER_API size_t get_decoded_bits_count(size_t handle);
 extern "C" ENCODER_API void get_decoded_data(size_t handle, BYTE * data_buf);
+// bytes get_decoded_data writes, read from the header without decoding
+extern "C" ENCODER_API size_t get_decoded_data_size(size_t handle);
+// statistics of the data decoded last, decode_range excluded, zero before
+// anything is decoded
+extern "C" ENCODER_API void get_decoder_statistics(size_t handle, coding_statistics* statistics);
+
+// Zero-copy decoding: the encoded data, header included, is borrowed and has
+// to stay valid until it is decoded. decode_to_buffer returns the bytes written
+// and throws if data_buf is smaller than get_decoded_data_size.
+extern "C" ENCODER_API void feed_borrowed_data_to_decoder(size_t handle, const BYTE* data, size_t data_size);
+extern "C" ENCODER_API size_t decode_to_buffer(size_t handle, BYTE* data_buf, size_t data_size);
+// Threads used to decode files carrying a seek index or several channels, 1 by
+// default, 0 means one per hardware thread
+extern "C" ENCODER_API void set_decoder_threads_count(size_t handle, unsigned int threads_count);
+
+// Decodes encoded_count independent encoded buffers, headers included, on the
+// shared thread pool. decoded_sizes receives the decoded byte counts. Throws
+// if an output buffer is too small.
+extern "C" ENCODER_API void decode_batch(const BYTE* const* encoded, const size_t* encoded_sizes, size_t encoded_count,
+    BYTE* const* decoded, const size_t* decoded_capacities, size_t* decoded_sizes);
+
+// Random access to a single channel file opened with decode_from_file. Only the reference
+// sample segments holding the window are decoded, they are found with the seek
+// index when the file has one or with a block scan made once otherwise.
+extern "C" ENCODER_API size_t get_decoded_samples_count(size_t handle);
+// data_buf receives count samples packed like get_decoded_data,
+// (count * sample_resolution + 7) / 8 bytes
+extern "C" ENCODER_API void decode_range(size_t handle, size_t first_sample, size_t count, BYTE* data_buf);
+
+// Streaming decoding of single channel data: push encoded chunks of any size,
+// the header included, and read decoded bytes in chunks of any size. Adaptive
+// reference data lists its early references only in the trailing seek index,
+// so push_data_to_decoder throws on its header.
+// read_decoded_bytes returns 0 when more input is needed or, if
+// is_decoding_stream_done, at the end.
+extern "C" ENCODER_API void start_decoding_stream(size_t handle);
+extern "C" ENCODER_API void push_data_to_decoder(size_t handle, const BYTE* data, size_t data_size);
+// no more input will be pushed
+extern "C" ENCODER_API void finish_decoding_stream(size_t handle);
+extern "C" ENCODER_API size_t read_decoded_bytes(size_t handle, BYTE* data_buf, size_t data_size);
+extern "C" ENCODER_API bool is_decoding_stream_done(size_t handle);
@@ -1,72 +1,137 @@
 #include "pch.h"
 #include "Encoder.h"
-#include <unordered_map>
 #include <vector>
 #include <memory>
 #include "encoding_machine.h"
+#include "handle_registry.h"
+#include "thread_pool.h"
 
 
-static std::unordered_map<size_t, std::unique_ptr<encoding_machine>> encoders;
-static size_t next_handle = 0;
+static handle_registry<encoding_machine> encoders;
 
-size_t create_encoder(unsigned int sample_resolution, unsigned int block_size)
+size_t create_encoder(unsigned int sample_resolution, unsigned int block_size, unsigned int selection, unsigned int reference_interval, unsigned int reference,
+    unsigned int predictor, unsigned int channels_count, unsigned int layout)
 {
-    encoders[next_handle] = std::make_unique<encoding_machine>(sample_resolution, block_size);
-    return next_handle++;
+    return encoders.add(std::make_unique<encoding_machine>(sample_resolution, block_size, selection, reference_interval, reference, predictor,
+        channels_count, layout));
 }
 
 void destroy_encoder(size_t handle)
 {
-    encoders.erase(handle);
+    encoders.remove(handle);
 }
 
 bool se_is_better(size_t handle)
 {
-    return encoders[handle]->se_better;
+    return encoders.get(handle)->is_second_extension_best();
+}
+
+void get_encoder_statistics(size_t handle, coding_statistics* statistics)
+{
+    *statistics = encoders.get(handle)->get_statistics();
 }
 
 void feed_data_to_encoder(size_t handle, BYTE* data, size_t data_size)
 {
-    std::vector<BYTE> data_vector;
-    data_vector.resize(data_size);
-    for (size_t i = 0; i < data_size; ++i)
-    {
-        data_vector[i] = data[i];
-    }
-    encoders[handle]->feed_data(data_vector);
+    encoders.get(handle)->feed_data(std::vector<BYTE>(data, data + data_size));
 }
 
 void encode_data(size_t handle)
 {
-    encoders[handle]->encode_data();
+    encoders.get(handle)->encode_data();
 }
 
 void encode_to_file(size_t handle, const char* filename)
 {
-    encoders[handle]->save_to_file(std::string{ filename });
+    encoders.get(handle)->save_to_file(std::string{ filename });
 }
 
 void encode_file_to_file(size_t handle, const char* source_filename, const char* destinataion_filename)
 {
-    encoders[handle]->feed_data_from_file(std::string{ source_filename });
-    encoders[handle]->save_to_file(std::string{ destinataion_filename });
+    encoders.get(handle)->feed_data_from_file(std::string{ source_filename });
+    encoders.get(handle)->save_to_file(std::string{ destinataion_filename });
 }
 
 size_t get_encoded_bits_count(size_t handle)
 {
-    return encoders[handle]->get_encoded_bits_count();
+    return encoders.get(handle)->get_encoded_bits_count();
 }
 
 void get_encoded_data(size_t handle, BYTE* data_buf, size_t data_size)
 {
-    if (data_size * 8 < encoders[handle]->get_encoded_bits_count())
-    {
-        throw std::exception{};
-    }
-    auto encoded_data = encoders[handle]->get_encoded_data();
-    for (size_t i = 0; i < encoded_data.size(); ++i)
-    {
-        data_buf[i] = encoded_data[i];
-    }
+    encoders.get(handle)->get_encoded_data(data_buf, data_size);
+}
+
+size_t get_encoded_data_size(size_t handle)
+{
+    return (encoders.get(handle)->get_encoded_bits_count() + 7) / 8;
+}
+
+void feed_borrowed_data_to_encoder(size_t handle, const BYTE* data, size_t data_size)
+{
+    encoders.get(handle)->feed_data(data, data_size);
+}
+
+size_t max_encoded_size(size_t handle, size_t data_size)
+{
+    return encoders.get(handle)->get_max_encoded_size(data_size);
+}
+
+size_t encode_to_buffer(size_t handle, BYTE* data_buf, size_t data_size)
+{
+    return encoders.get(handle)->encode_into(data_buf, data_size);
+}
+
+void encode_batch(unsigned int sample_resolution, unsigned int block_size, unsigned int selection,
+    const BYTE* const* data, const size_t* data_sizes, size_t data_count,
+    BYTE* const* encoded, const size_t* encoded_capacities, size_t* encoded_sizes)
+{
+    thread_pool::get_shared().run_ranges(data_count, [&](size_t first, size_t last) {
+        encoding_machine machine{ sample_resolution, block_size, selection };
+        for (size_t i = first; i < last; ++i)
+        {
+            machine.feed_data(data[i], data_sizes[i]);
+            encoded_sizes[i] = machine.write_encoded(encoded[i], encoded_capacities[i]);
+        }
+    });
+}
+
+void set_encoder_threads_count(size_t handle, unsigned int threads_count)
+{
+    encoders.get(handle)->set_threads_count(threads_count);
 }
 
+void stop_shared_threads()
+{
+    thread_pool::stop_shared();
+}
+
+void set_encoder_seek_index(size_t handle, bool enabled)
+{
+    encoders.get(handle)->set_write_index(enabled);
+}
+
+void start_encoding_stream(size_t handle)
+{
+    encoders.get(handle)->start_stream();
+}
+
+size_t push_data_to_encoder(size_t handle, const BYTE* data, size_t data_size)
+{
+    return encoders.get(handle)->push_data(data, data_size);
+}
+
+size_t finish_encoding_stream(size_t handle)
+{
+    return encoders.get(handle)->finish_stream();
+}
+
+size_t read_encoded_bytes(size_t handle, BYTE* data_buf, size_t data_size)
+{
+    return encoders.get(handle)->read_stream_bytes(data_buf, data_size);
+}
+
+void get_encoded_header(size_t handle, BYTE* header_buf)
+{
+    encoders.get(handle)->get_header(header_buf);
+}
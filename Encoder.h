@@ -1,18 +1,112 @@
 #pragma once
+#include <cstddef>
 #include "Byte.h"
+#include "export.h"
+#include "coding_statistics.h"
 
-#ifdef MATHLIBRARY_EXPORTS
-#define ENCODER_API __declspec(dllexport)
-#else
-#define ENCODER_API __declspec(dllimport)
-#endif
+// How encode_block picks the coding option of a block
+enum selection_mode
+{
+    selection_exact = 0,  // evaluates every option
+    selection_fast = 1,   // evaluates k - 1, k, k + 1 around an estimate, slightly worse ratio
+};
 
-extern "C" ENCODER_API size_t create_encoder(unsigned int sample_resolution, unsigned int block_size);
+// Where reference samples are placed, reference_interval blocks apart at most
+enum reference_mode
+{
+    reference_fixed = 0,     // every reference_interval blocks
+    reference_adaptive = 1,  // also earlier once a segment holds more than an
+                             // eighth of its uncompressed size, always writes the seek index;
+                             // the early ones are only known from it, so not for streaming
+};
+
+// How each sample is predicted before its error is coded
+enum predictor_type
+{
+    predictor_unit_delay = 0,    // the previous sample
+    predictor_polynomial_2 = 1,  // linear extrapolation of the last two samples
+    predictor_polynomial_3 = 2,  // quadratic extrapolation of the last three samples
+    predictor_sign_lms = 3,      // sign-sign LMS filter over the last sample differences
+};
+constexpr unsigned int predictors_count = 4;
+
+// Order of the samples of multichannel data, every channel is predicted and
+// encoded on its own
+enum sample_layout
+{
+    layout_interleaved = 0,  // band interleaved by pixel, one sample of every channel in turn
+    layout_sequential = 1,   // band sequential, every sample of a channel before the next one
+};
+constexpr unsigned int layouts_count = 2;
+constexpr unsigned int max_channels_count = 0xFFFF;
+
+constexpr unsigned int default_reference_interval = 4096;
+constexpr unsigned int max_reference_interval = 4096;
+// Blocks hold 8, 16, 32 or 64 samples
+constexpr size_t max_block_size = 64;
+
+// Size of the header that precedes the encoded data
+constexpr size_t encoded_header_size = 12;
+
+// With channels_count above 1 the data fed to the encoder holds the same
+// count of samples for every channel, followed only by zero bits up to the end
+// of its last byte. Padding can not be told apart from samples, so the largest
+// such count is taken and encoding throws if any nonzero bit would be left
+// over: samples that do not split evenly are rejected, never dropped.
+extern "C" ENCODER_API size_t create_encoder(unsigned int sample_resolution, unsigned int block_size, unsigned int selection = selection_exact,
+    unsigned int reference_interval = default_reference_interval, unsigned int reference = reference_fixed,
+    unsigned int predictor = predictor_unit_delay, unsigned int channels_count = 1, unsigned int layout = layout_interleaved);
 extern "C" ENCODER_API void destroy_encoder(size_t handle);
+// true when the second extension coded more blocks of the data encoded last
+// than any other option
 extern "C" ENCODER_API bool se_is_better(size_t handle);
+// statistics of the data encoded last, zero before anything is encoded
+extern "C" ENCODER_API void get_encoder_statistics(size_t handle, coding_statistics* statistics);
 extern "C" ENCODER_API void feed_data_to_encoder(size_t handle, BYTE* data, size_t data_size);
 extern "C" ENCODER_API void encode_data(size_t handle);
 extern "C" ENCODER_API void encode_to_file(size_t handle, const char* filename);
 extern "C" ENCODER_API void encode_file_to_file(size_t handle, const char* source_filename, const char* destinataion_filename);
 extern "C" ENCODER_API size_t get_encoded_bits_count(size_t handle);
 extern "C" ENCODER_API void get_encoded_data(size_t handle, BYTE* data_buf, size_t data_size);
+// bytes get_encoded_data writes
+extern "C" ENCODER_API size_t get_encoded_data_size(size_t handle);
+
+// Zero-copy encoding: the data is borrowed, not copied, and has to stay valid
+// until it is encoded. encode_to_buffer writes the header, the encoded data and
+// the seek index straight into data_buf and returns the bytes written, a
+// data_buf of max_encoded_size bytes is always large enough.
+extern "C" ENCODER_API void feed_borrowed_data_to_encoder(size_t handle, const BYTE* data, size_t data_size);
+extern "C" ENCODER_API size_t max_encoded_size(size_t handle, size_t data_size);
+extern "C" ENCODER_API size_t encode_to_buffer(size_t handle, BYTE* data_buf, size_t data_size);
+// Threads used by encode_data, 1 by default, 0 means one per hardware thread.
+// The output is identical to the single threaded one. Multichannel data is
+// encoded a channel per task, it can not be streamed.
+extern "C" ENCODER_API void set_encoder_threads_count(size_t handle, unsigned int threads_count);
+// Joins the threads of the pool that encode_batch, decode_batch and handles
+// using 0 threads share. Call it with no encoding or decoding running, before
+// unloading the library, later calls start the pool again.
+extern "C" ENCODER_API void stop_shared_threads();
+
+// Appends the seek index trailer to encoded files and streams, off by default
+extern "C" ENCODER_API void set_encoder_seek_index(size_t handle, bool enabled);
+
+// Encodes data_count independent buffers with the same parameters on the
+// shared thread pool. Every output receives the header and the encoded data,
+// its size goes to encoded_sizes. Throws if an output buffer is too small.
+extern "C" ENCODER_API void encode_batch(unsigned int sample_resolution, unsigned int block_size, unsigned int selection,
+    const BYTE* const* data, const size_t* data_sizes, size_t data_count,
+    BYTE* const* encoded, const size_t* encoded_capacities, size_t* encoded_sizes);
+
+// Streaming encoding: push input chunks of any size and read the encoded bytes
+// as blocks complete. The header is emitted first with a zero sample count, so
+// after finish_encoding_stream the first encoded_header_size bytes of the
+// output must be replaced by get_encoded_header. Only single channel data with
+// reference_fixed can be streamed, start_encoding_stream throws otherwise.
+extern "C" ENCODER_API void start_encoding_stream(size_t handle);
+// returns the count of encoded bytes ready to be read
+extern "C" ENCODER_API size_t push_data_to_encoder(size_t handle, const BYTE* data, size_t data_size);
+extern "C" ENCODER_API size_t finish_encoding_stream(size_t handle);
+// returns the count of bytes copied to data_buf
+extern "C" ENCODER_API size_t read_encoded_bytes(size_t handle, BYTE* data_buf, size_t data_size);
+// header_buf must hold encoded_header_size bytes
+extern "C" ENCODER_API void get_encoded_header(size_t handle, BYTE* header_buf);
@@ -0,0 +1,805 @@
+// Measures encoding and decoding speed and the compression ratio over
+// synthetic corpora, for every block size and a range of sample resolutions,
+// the ratio fast option selection loses against the exact one and the decoding
+// speed of Second Extension codewords. Round trips also run with every other
+// predictor, the seek index, adaptive references, multichannel layouts,
+// streaming and decode_range. Results are written as JSON, to stdout or to
+// the --output file, the exit code is 1 when any round trip fails.
+//
+// usage: diploma_benchmark [--samples N] [--repeats N] [--threads N] [--output FILE]
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <functional>
+#include <exception>
+#include "Encoder.h"
+#include "Decoder.h"
+
+namespace
+{
+    struct options
+    {
+        size_t samples_count = size_t{ 1 } << 20;
+        unsigned int repeats = 3;
+        unsigned int threads_count = 1;
+        std::string output;
+    };
+
+    struct corpus
+    {
+        std::string name;
+        // 0 runs the corpus at every resolution
+        unsigned int sample_resolution;
+        std::function<std::vector<uint32_t>(size_t samples_count, unsigned int sample_resolution)> generate;
+    };
+
+    struct result
+    {
+        std::string corpus;
+        unsigned int sample_resolution = 0;
+        unsigned int block_size = 0;
+        size_t input_size = 0;
+        size_t encoded_size = 0;
+        double encode_seconds = 0;
+        double decode_seconds = 0;
+        bool round_trip = false;
+        // the same data encoded with selection_fast
+        size_t fast_encoded_size = 0;
+        double fast_encode_seconds = 0;
+    };
+
+    enum run_kind
+    {
+        run_buffer,  // encode_to_buffer and decode_to_buffer
+        run_stream,  // streaming encoding and decoding in chunks
+        run_range,   // decode_range over windows of the encoded data
+    };
+
+    // Encoder options of a round trip, the defaults are those of the results
+    struct configuration
+    {
+        std::string name;
+        unsigned int selection = selection_exact;
+        unsigned int reference_interval = default_reference_interval;
+        unsigned int reference = reference_fixed;
+        unsigned int predictor = predictor_unit_delay;
+        unsigned int channels_count = 1;
+        unsigned int layout = layout_interleaved;
+        bool seek_index = false;
+        run_kind kind = run_buffer;
+        // samples past a multiple of channels_count, such data has to be
+        // rejected or decoded whole, never cut
+        size_t extra_samples = 0;
+    };
+
+    struct configuration_result
+    {
+        std::string configuration;
+        std::string corpus;
+        unsigned int sample_resolution = 0;
+        unsigned int block_size = 0;
+        size_t input_size = 0;
+        size_t encoded_size = 0;
+        // bytes the decoding produced, the windows only for decode_range
+        size_t decoded_size = 0;
+        double encode_seconds = 0;
+        double decode_seconds = 0;
+        bool round_trip = false;
+    };
+
+    // the configurations run over these corpora, at every block size
+    struct corpus_setting
+    {
+        const char* corpus;
+        unsigned int sample_resolution;
+    };
+
+    // Second Extension codewords of [first, end), [0, T(64)) holds every one the
+    // encoder emits, longer ones only come from other encoders
+    struct codeword_range
+    {
+        uint64_t first;
+        uint64_t end;
+    };
+
+    struct second_extension_result
+    {
+        codeword_range range;
+        size_t codewords_count;
+        double decode_seconds;
+        bool decoded;
+    };
+
+    struct report
+    {
+        std::vector<result> results;
+        std::vector<configuration_result> configurations;
+        std::vector<second_extension_result> second_extension;
+    };
+
+    // MSB first, as the encoded streams are
+    struct bit_sink
+    {
+        std::vector<BYTE> data;
+        size_t bits_count = 0;
+
+        void write_bits(uint64_t value, unsigned int count)
+        {
+            for (unsigned int i = count; i > 0; --i)
+            {
+                write_bit((value >> (i - 1)) & 1);
+            }
+        }
+
+        void write_unary(uint64_t count)
+        {
+            bits_count += count;
+            write_bit(1);
+        }
+
+        void write_bit(bool value)
+        {
+            data.resize(bits_count / 8 + 1);
+            if (value)
+            {
+                data[bits_count / 8] |= static_cast<BYTE>(0x80 >> (bits_count % 8));
+            }
+            ++bits_count;
+        }
+    };
+
+    constexpr unsigned int block_sizes[] = { 8, 16, 32, 64 };
+    constexpr unsigned int sample_resolutions[] = { 4, 8, 12, 16, 24, 32 };
+    constexpr size_t image_width = 1024;
+    constexpr codeword_range second_extension_ranges[] = { { 0, 36 }, { 0, 2080 }, { 2080, 8256 } };
+    // 16-bit samples in blocks of 64, a reference sample every 4096 blocks
+    constexpr unsigned int second_extension_resolution = 16;
+    constexpr unsigned int second_extension_prefix_size = 4;
+    constexpr unsigned int second_extension_block_size = 64;
+    constexpr size_t second_extension_reference_interval = 4096;
+    constexpr BYTE second_extension_header[] = { 0b01110000, 0b00100000, second_extension_resolution - 1, 0b01111111, 0xFF, 0 };
+    // at 3 bits the padding of the last byte can hold whole samples
+    constexpr corpus_setting configuration_corpora[] = { { "noise", 3 }, { "laplacian_16", 16 }, { "image_12bit", 12 } };
+    // short segments, so that the index has entries to seek to
+    constexpr unsigned int index_reference_interval = 64;
+    constexpr unsigned int multichannel_channels_count = 4;
+    constexpr size_t stream_chunk_size = 64 * 1024;
+    constexpr size_t range_windows_count = 256;
+    constexpr size_t max_range_window_samples = 4096;
+
+    uint32_t get_max_value(unsigned int sample_resolution)
+    {
+        return static_cast<uint32_t>((uint64_t{ 1 } << sample_resolution) - 1);
+    }
+
+    uint32_t clamp_sample(double value, unsigned int sample_resolution)
+    {
+        double max_value = get_max_value(sample_resolution);
+        return static_cast<uint32_t>(value < 0 ? 0 : value > max_value ? max_value : value);
+    }
+
+    std::vector<uint32_t> make_constant(size_t samples_count, unsigned int sample_resolution)
+    {
+        return std::vector<uint32_t>(samples_count, get_max_value(sample_resolution) / 2);
+    }
+
+    // A walk around the middle value whose unit-delay residuals are Laplacian
+    // with the given spread
+    std::vector<uint32_t> make_laplacian(size_t samples_count, unsigned int sample_resolution, double spread)
+    {
+        std::mt19937_64 random{ 1 };
+        std::exponential_distribution<double> magnitude{ 1 / spread };
+        double middle = get_max_value(sample_resolution) / 2.0;
+        double value = middle;
+        std::vector<uint32_t> samples(samples_count);
+        for (auto& sample : samples)
+        {
+            double residual = (random() & 1) ? magnitude(random) : -magnitude(random);
+            value = clamp_sample(value + residual - (value - middle) / 64, sample_resolution);
+            sample = static_cast<uint32_t>(value);
+        }
+        return samples;
+    }
+
+    std::vector<uint32_t> make_noise(size_t samples_count, unsigned int sample_resolution)
+    {
+        std::mt19937_64 random{ 2 };
+        std::vector<uint32_t> samples(samples_count);
+        for (auto& sample : samples)
+        {
+            sample = static_cast<uint32_t>(random()) & get_max_value(sample_resolution);
+        }
+        return samples;
+    }
+
+    // Runs of a repeated value between 64 and 4096 samples long
+    std::vector<uint32_t> make_zero_runs(size_t samples_count, unsigned int sample_resolution)
+    {
+        std::mt19937_64 random{ 3 };
+        std::vector<uint32_t> samples(samples_count);
+        size_t i = 0;
+        while (i < samples_count)
+        {
+            uint32_t value = static_cast<uint32_t>(random()) & get_max_value(sample_resolution);
+            size_t run_end = i + 64 + random() % 4033;
+            for (; i < samples_count && i < run_end; ++i)
+            {
+                samples[i] = value;
+            }
+        }
+        return samples;
+    }
+
+    // Residuals over the whole 32-bit range, whose costs once wrapped around:
+    // a block that has to stay uncompressed, then a random walk ending in a
+    // partial block
+    std::vector<uint32_t> make_wide_residuals(size_t samples_count, unsigned int)
+    {
+        std::mt19937_64 random{ 6 };
+        std::vector<uint32_t> samples(8, 0x80000000);
+        samples.push_back(0x8000000A);
+        samples.insert(samples.end(), 7, 1);
+        uint32_t value = static_cast<uint32_t>(random());
+        while (samples.size() < (samples_count | 1))
+        {
+            value += static_cast<uint32_t>(random() % 2000000001) - 1000000000u;
+            samples.push_back(value);
+        }
+        return samples;
+    }
+
+    // Rows of a smooth image with a few bright spots and sensor noise
+    std::vector<uint32_t> make_image(size_t samples_count, unsigned int sample_resolution)
+    {
+        std::mt19937_64 random{ 4 };
+        std::normal_distribution<double> noise{ 0, 2 };
+        double max_value = get_max_value(sample_resolution);
+        std::vector<uint32_t> samples(samples_count);
+        for (size_t i = 0; i < samples_count; ++i)
+        {
+            double x = static_cast<double>(i % image_width) / image_width;
+            double y = static_cast<double>(i / image_width) / image_width;
+            double value = 0.3 + 0.2 * x + 0.1 * std::sin(6 * y) + 0.3 * std::exp(-40 * ((x - 0.5) * (x - 0.5) + (y - 0.3) * (y - 0.3)));
+            samples[i] = clamp_sample(value * max_value + noise(random), sample_resolution);
+        }
+        return samples;
+    }
+
+    std::vector<BYTE> pack_samples(const std::vector<uint32_t>& samples, unsigned int sample_resolution)
+    {
+        std::vector<BYTE> data((samples.size() * sample_resolution + 7) / 8);
+        size_t bit_i = 0;
+        for (uint32_t sample : samples)
+        {
+            for (unsigned int i = sample_resolution; i > 0; --i, ++bit_i)
+            {
+                if ((sample >> (i - 1)) & 1)
+                {
+                    data[bit_i / 8] |= static_cast<BYTE>(0x80 >> (bit_i % 8));
+                }
+            }
+        }
+        return data;
+    }
+
+    double seconds_since(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    size_t create_configured_encoder(unsigned int sample_resolution, unsigned int block_size, const configuration& setup)
+    {
+        size_t encoder = create_encoder(sample_resolution, block_size, setup.selection, setup.reference_interval, setup.reference,
+            setup.predictor, setup.channels_count, setup.layout);
+        set_encoder_seek_index(encoder, setup.seek_index);
+        return encoder;
+    }
+
+    // the fastest of the repeats goes to seconds
+    std::vector<BYTE> encode(const std::vector<BYTE>& data, unsigned int sample_resolution, unsigned int block_size, const configuration& setup,
+        const options& settings, double& seconds)
+    {
+        std::vector<BYTE> encoded;
+        for (unsigned int i = 0; i < settings.repeats; ++i)
+        {
+            size_t encoder = create_configured_encoder(sample_resolution, block_size, setup);
+            set_encoder_threads_count(encoder, settings.threads_count);
+            feed_borrowed_data_to_encoder(encoder, data.data(), data.size());
+            encoded.resize(max_encoded_size(encoder, data.size()));
+            auto start = std::chrono::steady_clock::now();
+            encoded.resize(encode_to_buffer(encoder, encoded.data(), encoded.size()));
+            double repeat_seconds = seconds_since(start);
+            destroy_encoder(encoder);
+            seconds = i == 0 || repeat_seconds < seconds ? repeat_seconds : seconds;
+        }
+        return encoded;
+    }
+
+    std::vector<BYTE> decode(const std::vector<BYTE>& encoded, unsigned int repeats, const options& settings, double& seconds)
+    {
+        std::vector<BYTE> decoded;
+        for (unsigned int i = 0; i < repeats; ++i)
+        {
+            size_t decoder = create_decoder();
+            set_decoder_threads_count(decoder, settings.threads_count);
+            feed_borrowed_data_to_decoder(decoder, encoded.data(), encoded.size());
+            decoded.resize(get_decoded_data_size(decoder));
+            auto start = std::chrono::steady_clock::now();
+            decoded.resize(decode_to_buffer(decoder, decoded.data(), decoded.size()));
+            double repeat_seconds = seconds_since(start);
+            destroy_decoder(decoder);
+            seconds = i == 0 || repeat_seconds < seconds ? repeat_seconds : seconds;
+        }
+        return decoded;
+    }
+
+    // The input is pushed and the output read in stream_chunk_size chunks, the
+    // header is replaced once the stream is finished
+    std::vector<BYTE> encode_stream(const std::vector<BYTE>& data, unsigned int sample_resolution, unsigned int block_size, const configuration& setup,
+        const options& settings, double& seconds)
+    {
+        std::vector<BYTE> encoded;
+        std::vector<BYTE> chunk(stream_chunk_size);
+        for (unsigned int i = 0; i < settings.repeats; ++i)
+        {
+            size_t encoder = create_configured_encoder(sample_resolution, block_size, setup);
+            encoded.clear();
+            auto read_ready = [&]() {
+                size_t read_count;
+                while ((read_count = read_encoded_bytes(encoder, chunk.data(), chunk.size())) != 0)
+                {
+                    encoded.insert(encoded.end(), chunk.begin(), chunk.begin() + read_count);
+                }
+            };
+            auto start = std::chrono::steady_clock::now();
+            start_encoding_stream(encoder);
+            for (size_t position = 0; position < data.size(); position += stream_chunk_size)
+            {
+                size_t chunk_size = data.size() - position < stream_chunk_size ? data.size() - position : stream_chunk_size;
+                push_data_to_encoder(encoder, data.data() + position, chunk_size);
+                read_ready();
+            }
+            finish_encoding_stream(encoder);
+            read_ready();
+            get_encoded_header(encoder, encoded.data());
+            double repeat_seconds = seconds_since(start);
+            destroy_encoder(encoder);
+            seconds = i == 0 || repeat_seconds < seconds ? repeat_seconds : seconds;
+        }
+        return encoded;
+    }
+
+    std::vector<BYTE> decode_stream(const std::vector<BYTE>& encoded, const options& settings, double& seconds)
+    {
+        std::vector<BYTE> decoded;
+        std::vector<BYTE> chunk(stream_chunk_size);
+        for (unsigned int i = 0; i < settings.repeats; ++i)
+        {
+            size_t decoder = create_decoder();
+            decoded.clear();
+            auto read_ready = [&]() {
+                size_t read_count;
+                while ((read_count = read_decoded_bytes(decoder, chunk.data(), chunk.size())) != 0)
+                {
+                    decoded.insert(decoded.end(), chunk.begin(), chunk.begin() + read_count);
+                }
+            };
+            auto start = std::chrono::steady_clock::now();
+            start_decoding_stream(decoder);
+            for (size_t position = 0; position < encoded.size(); position += stream_chunk_size)
+            {
+                size_t chunk_size = encoded.size() - position < stream_chunk_size ? encoded.size() - position : stream_chunk_size;
+                push_data_to_decoder(decoder, encoded.data() + position, chunk_size);
+                read_ready();
+            }
+            finish_decoding_stream(decoder);
+            read_ready();
+            double repeat_seconds = seconds_since(start);
+            bool done = is_decoding_stream_done(decoder);
+            destroy_decoder(decoder);
+            if (!done)
+            {
+                throw std::exception{};
+            }
+            seconds = i == 0 || repeat_seconds < seconds ? repeat_seconds : seconds;
+        }
+        return decoded;
+    }
+
+    // Decodes range_windows_count windows at random positions and compares
+    // each with the samples it covers. seconds is the total of one pass.
+    bool decode_windows(const std::vector<BYTE>& encoded, const std::vector<uint32_t>& samples, unsigned int sample_resolution,
+        double& seconds, size_t& decoded_size)
+    {
+        std::mt19937_64 random{ 7 };
+        size_t decoder = create_decoder();
+        feed_borrowed_data_to_decoder(decoder, encoded.data(), encoded.size());
+        bool decoded = get_decoded_samples_count(decoder) == samples.size();
+        seconds = 0;
+        decoded_size = 0;
+        std::vector<BYTE> window;
+        for (size_t i = 0; i < range_windows_count && decoded && !samples.empty(); ++i)
+        {
+            size_t count = 1 + random() % max_range_window_samples;
+            count = count < samples.size() ? count : samples.size();
+            size_t first_sample = random() % (samples.size() - count + 1);
+            window.assign((count * sample_resolution + 7) / 8, 0);
+            auto start = std::chrono::steady_clock::now();
+            decode_range(decoder, first_sample, count, window.data());
+            seconds += seconds_since(start);
+            decoded_size += window.size();
+            std::vector<uint32_t> expected(samples.begin() + first_sample, samples.begin() + first_sample + count);
+            decoded = pack_samples(expected, sample_resolution) == window;
+        }
+        destroy_decoder(decoder);
+        return decoded;
+    }
+
+    configuration_result run_configuration(const configuration& setup, const corpus& source, std::vector<uint32_t> samples,
+        unsigned int sample_resolution, unsigned int block_size, const options& settings)
+    {
+        // every channel holds the same count of samples, but for extra_samples
+        size_t whole_samples_count = samples.size() / setup.channels_count * setup.channels_count;
+        if (whole_samples_count + setup.extra_samples > samples.size() && whole_samples_count >= setup.channels_count)
+        {
+            whole_samples_count -= setup.channels_count;
+        }
+        // uneven data fills whole bytes, so that cut samples do not change its size
+        while (setup.extra_samples != 0 && whole_samples_count >= setup.channels_count
+            && (whole_samples_count + setup.extra_samples) * sample_resolution % 8 != 0)
+        {
+            whole_samples_count -= setup.channels_count;
+        }
+        samples.resize(whole_samples_count + setup.extra_samples);
+        auto data = pack_samples(samples, sample_resolution);
+        configuration_result measured{ setup.name, source.name, sample_resolution, block_size, data.size() };
+        std::vector<BYTE> encoded;
+        if (setup.kind == run_stream)
+        {
+            encoded = encode_stream(data, sample_resolution, block_size, setup, settings, measured.encode_seconds);
+            measured.round_trip = decode_stream(encoded, settings, measured.decode_seconds) == data;
+            measured.decoded_size = data.size();
+        }
+        else if (setup.kind == run_range)
+        {
+            encoded = encode(data, sample_resolution, block_size, setup, settings, measured.encode_seconds);
+            measured.round_trip = decode_windows(encoded, samples, sample_resolution, measured.decode_seconds, measured.decoded_size);
+        }
+        else
+        {
+            try
+            {
+                encoded = encode(data, sample_resolution, block_size, setup, settings, measured.encode_seconds);
+            }
+            catch (const std::exception&)
+            {
+                measured.round_trip = setup.extra_samples != 0;
+                return measured;
+            }
+            measured.round_trip = decode(encoded, settings.repeats, settings, measured.decode_seconds) == data;
+            measured.decoded_size = data.size();
+        }
+        measured.encoded_size = encoded.size();
+        return measured;
+    }
+
+    // The fast selection output is only decoded once, to check it
+    result run(const corpus& source, const std::vector<BYTE>& data, unsigned int sample_resolution, unsigned int block_size, const options& settings)
+    {
+        result measured{ source.name, sample_resolution, block_size, data.size() };
+        auto encoded = encode(data, sample_resolution, block_size, configuration{ "exact_selection" }, settings, measured.encode_seconds);
+        measured.encoded_size = encoded.size();
+        measured.round_trip = decode(encoded, settings.repeats, settings, measured.decode_seconds) == data;
+
+        configuration fast_selection{ .name = "fast_selection", .selection = selection_fast };
+        auto fast_encoded = encode(data, sample_resolution, block_size, fast_selection, settings, measured.fast_encode_seconds);
+        measured.fast_encoded_size = fast_encoded.size();
+        double fast_decode_seconds;
+        measured.round_trip = measured.round_trip && decode(fast_encoded, 1, settings, fast_decode_seconds) == data;
+        return measured;
+    }
+
+    uint64_t get_triangle(uint64_t diagonal)
+    {
+        return diagonal * (diagonal + 1) / 2;
+    }
+
+    // A stream of Second Extension blocks only, whose codewords are spread
+    // evenly over the range. The first pair of a reference block has a zero
+    // first sample, so it keeps only the second one of the drawn pair.
+    std::vector<BYTE> make_second_extension_stream(const codeword_range& range, size_t blocks_count)
+    {
+        std::mt19937_64 random{ 5 };
+        bit_sink sink;
+        uint64_t samples_count = uint64_t{ blocks_count } * second_extension_block_size;
+        for (BYTE header_byte : second_extension_header)
+        {
+            sink.write_bits(header_byte, 8);
+        }
+        sink.write_bits(samples_count, 48);
+        for (size_t block_i = 0; block_i < blocks_count; ++block_i)
+        {
+            bool reference = block_i % second_extension_reference_interval == 0;
+            sink.write_bits(1, second_extension_prefix_size + 1);
+            if (reference)
+            {
+                sink.write_bits(random() & get_max_value(second_extension_resolution), second_extension_resolution);
+            }
+            for (unsigned int i = 0; i < second_extension_block_size; i += 2)
+            {
+                uint64_t codeword = range.first + random() % (range.end - range.first);
+                if (reference && i == 0)
+                {
+                    uint64_t diagonal = 0;
+                    while (get_triangle(diagonal + 1) <= codeword)
+                    {
+                        ++diagonal;
+                    }
+                    uint64_t sample_b = codeword - get_triangle(diagonal);
+                    codeword = get_triangle(sample_b) + sample_b;
+                }
+                sink.write_unary(codeword);
+            }
+        }
+        return sink.data;
+    }
+
+    // the codewords are bounded by the stream size too, since long ones are
+    // as long to read
+    second_extension_result run_second_extension(const codeword_range& range, const options& settings)
+    {
+        size_t pairs_count = second_extension_block_size / 2;
+        size_t mean_codeword_bits = (range.first + range.end) / 2 + 1;
+        size_t codewords_count = settings.samples_count / 2;
+        if (codewords_count > settings.samples_count * 128 / mean_codeword_bits)
+        {
+            codewords_count = settings.samples_count * 128 / mean_codeword_bits;
+        }
+        size_t blocks_count = codewords_count / pairs_count + 1;
+        auto encoded = make_second_extension_stream(range, blocks_count);
+        second_extension_result measured{ range, blocks_count * pairs_count, 0, true };
+
+        std::vector<BYTE> decoded;
+        for (unsigned int i = 0; i < settings.repeats; ++i)
+        {
+            size_t decoder = create_decoder();
+            feed_borrowed_data_to_decoder(decoder, encoded.data(), encoded.size());
+            decoded.resize(get_decoded_data_size(decoder));
+            auto start = std::chrono::steady_clock::now();
+            decode_to_buffer(decoder, decoded.data(), decoded.size());
+            double seconds = seconds_since(start);
+            coding_statistics statistics;
+            get_decoder_statistics(decoder, &statistics);
+            destroy_decoder(decoder);
+            measured.decode_seconds = i == 0 || seconds < measured.decode_seconds ? seconds : measured.decode_seconds;
+            measured.decoded = measured.decoded && statistics.blocks[option_second_extension] == blocks_count;
+        }
+        return measured;
+    }
+
+    double get_mb_per_second(size_t bytes_count, double seconds)
+    {
+        return seconds > 0 ? bytes_count / seconds / 1e6 : 0;
+    }
+
+    // how much smaller the compression ratio of fast selection is, in percent
+    double get_ratio_loss(size_t exact_size, size_t fast_size)
+    {
+        return fast_size != 0 ? (1 - static_cast<double>(exact_size) / fast_size) * 100 : 0;
+    }
+
+    void write_results(FILE* file, const options& settings, const report& measured_report)
+    {
+        const std::vector<result>& results = measured_report.results;
+        std::fprintf(file, "{\n  \"samples\": %zu,\n  \"repeats\": %u,\n  \"threads\": %u,\n  \"results\": [\n",
+            settings.samples_count, settings.repeats, settings.threads_count);
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            const result& measured = results[i];
+            std::fprintf(file,
+                "    {\"corpus\": \"%s\", \"sample_resolution\": %u, \"block_size\": %u, \"input_bytes\": %zu, \"encoded_bytes\": %zu, "
+                "\"ratio\": %.4f, \"encode_mb_s\": %.2f, \"decode_mb_s\": %.2f, "
+                "\"fast_encoded_bytes\": %zu, \"fast_encode_mb_s\": %.2f, \"fast_ratio_loss_percent\": %.4f, \"round_trip\": %s}%s\n",
+                measured.corpus.c_str(), measured.sample_resolution, measured.block_size, measured.input_size, measured.encoded_size,
+                measured.encoded_size != 0 ? static_cast<double>(measured.input_size) / measured.encoded_size : 0,
+                get_mb_per_second(measured.input_size, measured.encode_seconds),
+                get_mb_per_second(measured.input_size, measured.decode_seconds),
+                measured.fast_encoded_size, get_mb_per_second(measured.input_size, measured.fast_encode_seconds),
+                get_ratio_loss(measured.encoded_size, measured.fast_encoded_size),
+                measured.round_trip ? "true" : "false", i + 1 < results.size() ? "," : "");
+        }
+        size_t exact_size = 0;
+        size_t fast_size = 0;
+        for (const result& measured : results)
+        {
+            exact_size += measured.encoded_size;
+            fast_size += measured.fast_encoded_size;
+        }
+        std::fprintf(file, "  ],\n  \"fast_selection\": {\"exact_encoded_bytes\": %zu, \"fast_encoded_bytes\": %zu, \"ratio_loss_percent\": %.4f},\n",
+            exact_size, fast_size, get_ratio_loss(exact_size, fast_size));
+        std::fprintf(file, "  \"configurations\": [\n");
+        const auto& configurations = measured_report.configurations;
+        for (size_t i = 0; i < configurations.size(); ++i)
+        {
+            const configuration_result& measured = configurations[i];
+            std::fprintf(file,
+                "    {\"configuration\": \"%s\", \"corpus\": \"%s\", \"sample_resolution\": %u, \"block_size\": %u, \"input_bytes\": %zu, "
+                "\"encoded_bytes\": %zu, \"ratio\": %.4f, \"encode_mb_s\": %.2f, \"decoded_bytes\": %zu, \"decode_mb_s\": %.2f, \"round_trip\": %s}%s\n",
+                measured.configuration.c_str(), measured.corpus.c_str(), measured.sample_resolution, measured.block_size, measured.input_size,
+                measured.encoded_size, measured.encoded_size != 0 ? static_cast<double>(measured.input_size) / measured.encoded_size : 0,
+                get_mb_per_second(measured.input_size, measured.encode_seconds), measured.decoded_size,
+                get_mb_per_second(measured.decoded_size, measured.decode_seconds),
+                measured.round_trip ? "true" : "false", i + 1 < configurations.size() ? "," : "");
+        }
+        std::fprintf(file, "  ],\n");
+        std::fprintf(file, "  \"second_extension_decode\": [\n");
+        const auto& second_extension = measured_report.second_extension;
+        for (size_t i = 0; i < second_extension.size(); ++i)
+        {
+            const second_extension_result& measured = second_extension[i];
+            std::fprintf(file,
+                "    {\"first_codeword\": %llu, \"end_codeword\": %llu, \"codewords\": %zu, \"decode_ns_per_codeword\": %.2f, \"decoded\": %s}%s\n",
+                static_cast<unsigned long long>(measured.range.first), static_cast<unsigned long long>(measured.range.end), measured.codewords_count,
+                measured.codewords_count != 0 ? measured.decode_seconds * 1e9 / measured.codewords_count : 0, measured.decoded ? "true" : "false", i + 1 < second_extension.size() ? "," : "");
+        }
+        std::fprintf(file, "  ]\n}\n");
+    }
+
+    bool parse_options(int argc, char** argv, options& settings)
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            if (i + 1 == argc)
+            {
+                return false;
+            }
+            std::string name = argv[i];
+            const char* value = argv[++i];
+            if (name == "--samples")
+            {
+                settings.samples_count = std::strtoull(value, nullptr, 10);
+            }
+            else if (name == "--repeats")
+            {
+                settings.repeats = static_cast<unsigned int>(std::strtoul(value, nullptr, 10));
+            }
+            else if (name == "--threads")
+            {
+                settings.threads_count = static_cast<unsigned int>(std::strtoul(value, nullptr, 10));
+            }
+            else if (name == "--output")
+            {
+                settings.output = value;
+            }
+            else
+            {
+                return false;
+            }
+        }
+        return settings.samples_count != 0 && settings.repeats != 0;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    options settings;
+    if (!parse_options(argc, argv, settings))
+    {
+        std::fprintf(stderr, "usage: %s [--samples N] [--repeats N] [--threads N] [--output FILE]\n", argv[0]);
+        return 2;
+    }
+
+    const std::vector<corpus> corpora = {
+        { "constant", 0, make_constant },
+        { "laplacian_1", 0, [](size_t count, unsigned int resolution) { return make_laplacian(count, resolution, 1); } },
+        { "laplacian_16", 0, [](size_t count, unsigned int resolution) { return make_laplacian(count, resolution, 16); } },
+        { "laplacian_256", 0, [](size_t count, unsigned int resolution) { return make_laplacian(count, resolution, 256); } },
+        { "noise", 0, make_noise },
+        { "zero_runs", 0, make_zero_runs },
+        { "image_12bit", 12, make_image },
+        { "wide_residuals", 32, make_wide_residuals },
+    };
+
+    report measured_report;
+    std::vector<result>& results = measured_report.results;
+    bool round_trips = true;
+    for (const auto& source : corpora)
+    {
+        for (unsigned int sample_resolution : sample_resolutions)
+        {
+            if (source.sample_resolution != 0 && source.sample_resolution != sample_resolution)
+            {
+                continue;
+            }
+            auto data = pack_samples(source.generate(settings.samples_count, sample_resolution), sample_resolution);
+            for (unsigned int block_size : block_sizes)
+            {
+                try
+                {
+                    results.push_back(run(source, data, sample_resolution, block_size, settings));
+                }
+                catch (const std::exception&)
+                {
+                    results.push_back({ source.name, sample_resolution, block_size, data.size() });
+                }
+                round_trips = round_trips && results.back().round_trip;
+                std::fprintf(stderr, "%s res %u block %u done\n", source.name.c_str(), sample_resolution, block_size);
+            }
+        }
+    }
+
+    // the default options ran above, every other option runs on its own
+    const std::vector<configuration> configurations = {
+        { .name = "fast_selection", .selection = selection_fast },
+        { .name = "polynomial_2", .predictor = predictor_polynomial_2 },
+        { .name = "polynomial_3", .predictor = predictor_polynomial_3 },
+        { .name = "sign_lms", .predictor = predictor_sign_lms },
+        { .name = "seek_index", .reference_interval = index_reference_interval, .seek_index = true },
+        { .name = "adaptive_reference", .reference = reference_adaptive },
+        { .name = "multichannel_bip", .channels_count = multichannel_channels_count, .layout = layout_interleaved },
+        { .name = "multichannel_bsq", .channels_count = multichannel_channels_count, .layout = layout_sequential },
+        { .name = "multichannel_bip_uneven", .channels_count = 3, .layout = layout_interleaved, .extra_samples = 2 },
+        { .name = "multichannel_bsq_uneven", .channels_count = 3, .layout = layout_sequential, .extra_samples = 2 },
+        { .name = "stream", .kind = run_stream },
+        { .name = "decode_range", .reference_interval = index_reference_interval, .seek_index = true, .kind = run_range },
+    };
+    for (const auto& setting : configuration_corpora)
+    {
+        const corpus* source = nullptr;
+        for (const auto& candidate : corpora)
+        {
+            source = candidate.name == setting.corpus ? &candidate : source;
+        }
+        auto samples = source->generate(settings.samples_count, setting.sample_resolution);
+        for (const auto& setup : configurations)
+        {
+            for (unsigned int block_size : block_sizes)
+            {
+                try
+                {
+                    measured_report.configurations.push_back(run_configuration(setup, *source, samples, setting.sample_resolution, block_size, settings));
+                }
+                catch (const std::exception&)
+                {
+                    measured_report.configurations.push_back({ setup.name, source->name, setting.sample_resolution, block_size });
+                }
+                round_trips = round_trips && measured_report.configurations.back().round_trip;
+                std::fprintf(stderr, "%s %s res %u block %u done\n", setup.name.c_str(), source->name.c_str(), setting.sample_resolution, block_size);
+            }
+        }
+    }
+
+    for (const auto& range : second_extension_ranges)
+    {
+        try
+        {
+            measured_report.second_extension.push_back(run_second_extension(range, settings));
+        }
+        catch (const std::exception&)
+        {
+            measured_report.second_extension.push_back({ range, 0, 0, false });
+        }
+        round_trips = round_trips && measured_report.second_extension.back().decoded;
+        std::fprintf(stderr, "second extension [%llu, %llu) done\n",
+            static_cast<unsigned long long>(range.first), static_cast<unsigned long long>(range.end));
+    }
+
+    FILE* file = settings.output.empty() ? stdout : std::fopen(settings.output.c_str(), "w");
+    if (file == nullptr)
+    {
+        std::fprintf(stderr, "can not open %s\n", settings.output.c_str());
+        return 2;
+    }
+    write_results(file, settings, measured_report);
+    if (file != stdout)
+    {
+        std::fclose(file);
+    }
+    return round_trips ? 0 : 1;
+}
@@ -0,0 +1,28 @@
+#include "pch.h"
+#include "bit_reader.h"
+
+bit_reader::bit_reader(const BYTE* data, size_t data_size)
+	: data{ data },
+	data_size{ data_size }
+{
+}
+
+void bit_reader::skip(size_t count)
+{
+	position += count;
+}
+
+size_t bit_reader::get_position() const
+{
+	return position;
+}
+
+void bit_reader::set_position(size_t position)
+{
+	this->position = position;
+}
+
+size_t bit_reader::get_bits_count() const
+{
+	return data_size * 8;
+}
@@ -0,0 +1,98 @@
+#pragma once
+#include <cstdint>
+#include <bit>
+#include <exception>
+#include "Byte.h"
+
+// Reads MSB-first bit fields from a byte buffer it does not own. Every read
+// is served from a 64-bit big-endian window, unary runs are decoded with a
+// single count-leading-zeros per window.
+class bit_reader
+{
+private:
+	const BYTE* data = nullptr;
+	size_t data_size = 0;
+	size_t position = 0;
+public:
+	bit_reader() = default;
+	bit_reader(const BYTE* data, size_t data_size);
+
+	// next 64 bits starting at the current position, zero padded past the end
+	uint64_t peek() const;
+	// count <= 32
+	uint32_t read_bits(unsigned int count);
+	bool read_bit();
+	// number of zeros before the next one, the one is consumed too
+	uint64_t read_unary();
+	void skip(size_t count);
+
+	size_t get_position() const;
+	void set_position(size_t position);
+	size_t get_bits_count() const;
+};
+
+inline uint64_t bit_reader::peek() const
+{
+	size_t byte_i = position / 8;
+	uint64_t word = 0;
+	if (byte_i + 8 <= data_size)
+	{
+		for (size_t i = 0; i < 8; ++i)
+		{
+			word = (word << 8) | data[byte_i + i];
+		}
+	}
+	else
+	{
+		for (size_t i = 0; i < 8; ++i)
+		{
+			word <<= 8;
+			if (byte_i + i < data_size)
+			{
+				word |= data[byte_i + i];
+			}
+		}
+	}
+	return word << (position % 8);
+}
+
+inline uint32_t bit_reader::read_bits(unsigned int count)
+{
+	if (count == 0)
+	{
+		return 0;
+	}
+	if (position + count > data_size * 8)
+	{
+		throw std::exception{};
+	}
+	uint32_t result = static_cast<uint32_t>(peek() >> (64 - count));
+	position += count;
+	return result;
+}
+
+inline bool bit_reader::read_bit()
+{
+	return read_bits(1);
+}
+
+inline uint64_t bit_reader::read_unary()
+{
+	uint64_t count = 0;
+	while (true)
+	{
+		if (position >= data_size * 8)
+		{
+			throw std::exception{};
+		}
+		unsigned int available = 64 - position % 8;
+		unsigned int zeros = std::countl_zero(peek());
+		if (zeros < available)
+		{
+			position += zeros + 1;
+			return count + zeros;
+		}
+		count += available;
+		position += available;
+	}
+}
@@ -0,0 +1,168 @@
+#include "pch.h"
+#include "bit_writer.h"
+#include <algorithm>
+#include <exception>
+
+bit_writer::bit_writer(size_t expected_bits_count)
+{
+    reserve(expected_bits_count);
+}
+
+void bit_writer::reserve(size_t bits_count)
+{
+    size_t bytes_count = (bits_count + 7) / 8 + 4;
+    if (!attached && buffer_capacity < bytes_count)
+    {
+        owned_buffer.resize(bytes_count);
+        buffer = owned_buffer.data();
+        buffer_capacity = owned_buffer.size();
+    }
+}
+
+void bit_writer::grow(size_t bytes_count)
+{
+    if (attached)
+    {
+        throw std::exception{};
+    }
+    size_t grown_size = owned_buffer.size() * 2 + 64;
+    owned_buffer.resize(grown_size > bytes_count ? grown_size : bytes_count);
+    buffer = owned_buffer.data();
+    buffer_capacity = owned_buffer.size();
+}
+
+void bit_writer::attach(BYTE* dest, size_t dest_size)
+{
+    clear();
+    attached = true;
+    buffer = dest;
+    buffer_capacity = dest_size;
+}
+
+void bit_writer::detach()
+{
+    clear();
+    attached = false;
+    buffer = owned_buffer.data();
+    buffer_capacity = owned_buffer.size();
+}
+
+void bit_writer::clear()
+{
+    buffer_begin = 0;
+    buffer_size = 0;
+    taken_size = 0;
+    accumulator = 0;
+    accumulator_size = 0;
+}
+
+void bit_writer::append(const std::vector<BYTE>& data, size_t bits_count)
+{
+    size_t full_bytes = bits_count / 8;
+    size_t i = 0;
+    for (; i + 4 <= full_bytes; i += 4)
+    {
+        uint32_t word = (uint32_t{ data[i] } << 24) | (uint32_t{ data[i + 1] } << 16) | (uint32_t{ data[i + 2] } << 8) | data[i + 3];
+        write_bits(word, 32);
+    }
+    for (; i < full_bytes; ++i)
+    {
+        write_bits(data[i], 8);
+    }
+    unsigned int tail_size = bits_count % 8;
+    if (tail_size != 0)
+    {
+        write_bits(data[full_bytes] >> (8 - tail_size), tail_size);
+    }
+}
+
+std::vector<BYTE> bit_writer::get_data() const
+{
+    std::vector<BYTE> result{ buffer + buffer_begin, buffer + buffer_size };
+    uint64_t tail = accumulator;
+    for (unsigned int i = 0; i < accumulator_size; i += 8)
+    {
+        result.push_back(static_cast<BYTE>(tail >> 56));
+        tail <<= 8;
+    }
+    return result;
+}
+
+void bit_writer::copy_data(BYTE* dest) const
+{
+    dest = std::copy(buffer + buffer_begin, buffer + buffer_size, dest);
+    uint64_t tail = accumulator;
+    for (unsigned int i = 0; i < accumulator_size; i += 8)
+    {
+        *dest++ = static_cast<BYTE>(tail >> 56);
+        tail <<= 8;
+    }
+}
+
+void bit_writer::pad_to_byte()
+{
+    write_zeros((8 - accumulator_size % 8) % 8);
+    while (accumulator_size > 0)
+    {
+        if (buffer_size == buffer_capacity)
+        {
+            grow(buffer_size + 1);
+        }
+        buffer[buffer_size++] = static_cast<BYTE>(accumulator >> 56);
+        accumulator <<= 8;
+        accumulator_size -= 8;
+    }
+}
+
+BYTE* bit_writer::get_span(size_t bits_count)
+{
+    if (accumulator_size % 8 != 0)
+    {
+        throw std::exception{};
+    }
+    pad_to_byte();
+    size_t bytes_count = buffer_size + (bits_count + 7) / 8;
+    if (bytes_count > buffer_capacity)
+    {
+        grow(bytes_count);
+    }
+    return buffer + buffer_size;
+}
+
+void bit_writer::commit_span(size_t bits_count)
+{
+    buffer_size += bits_count / 8;
+    // the bits of a partial last byte go on in the accumulator
+    accumulator_size = bits_count % 8;
+    accumulator = 0;
+    if (accumulator_size != 0)
+    {
+        accumulator = (uint64_t{ buffer[buffer_size] } << 56) & (0xFFFFFFFFFFFFFFFFull << (64 - accumulator_size));
+    }
+}
+
+size_t bit_writer::get_ready_bytes_count() const
+{
+    return buffer_size - buffer_begin;
+}
+
+const BYTE* bit_writer::get_ready_bytes() const
+{
+    return buffer + buffer_begin;
+}
+
+size_t bit_writer::take_bytes(BYTE* dest, size_t count)
+{
+    count = count < get_ready_bytes_count() ? count : get_ready_bytes_count();
+    std::copy(buffer + buffer_begin, buffer + buffer_begin + count, dest);
+    buffer_begin += count;
+    // move the rest to the front once taken bytes dominate the buffer
+    if (buffer_begin * 2 >= buffer_size)
+    {
+        std::copy(buffer + buffer_begin, buffer + buffer_size, buffer);
+        taken_size += buffer_begin;
+        buffer_size -= buffer_begin;
+        buffer_begin = 0;
+    }
+    return count;
+}
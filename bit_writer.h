@@ -0,0 +1,120 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include "Byte.h"
+
+// Accumulates bits MSB-first in a 64-bit register and flushes them to the
+// byte buffer one 32-bit word at a time. The buffer is owned and grows, or is
+// attached memory of a fixed size that is never exceeded.
+class bit_writer
+{
+private:
+    std::vector<BYTE> owned_buffer;
+    BYTE* buffer = nullptr;
+    size_t buffer_capacity = 0;
+    bool attached = false;
+    size_t buffer_begin = 0;
+    size_t buffer_size = 0;
+    size_t taken_size = 0;
+    uint64_t accumulator = 0;
+    unsigned int accumulator_size = 0;
+
+    void flush_word();
+    void grow(size_t bytes_count);
+public:
+    bit_writer() = default;
+    explicit bit_writer(size_t expected_bits_count);
+    // buffer points into owned_buffer, which a move keeps in place
+    bit_writer(const bit_writer&) = delete;
+    bit_writer& operator=(const bit_writer&) = delete;
+    bit_writer(bit_writer&&) = default;
+    bit_writer& operator=(bit_writer&&) = default;
+
+    void reserve(size_t bits_count);
+    void clear();
+    // writes go to dest from now on, exceeding dest_size throws
+    void attach(BYTE* dest, size_t dest_size);
+    // clears and goes back to the owned buffer
+    void detach();
+
+    // count <= 32, bits of value above count are ignored
+    void write_bits(uint64_t value, unsigned int count);
+    void write_zeros(uint64_t count);
+    // count zeros followed by a single one
+    void write_unary(uint64_t count);
+    void append(const std::vector<BYTE>& data, size_t bits_count);
+    // pads the last byte with zeros so that every written bit can be taken
+    void pad_to_byte();
+    // Room for bits_count bits after the written ones, which have to end at a
+    // byte boundary. The caller fills it in, then commit_span counts the bits
+    // as written.
+    BYTE* get_span(size_t bits_count);
+    void commit_span(size_t bits_count);
+
+    // total bits written since clear, taken bytes included
+    size_t get_bits_count() const;
+    std::vector<BYTE> get_data() const;
+    // copies what get_data returns, (get_bits_count() + 7) / 8 bytes when
+    // nothing was taken
+    void copy_data(BYTE* dest) const;
+    // complete bytes that were written but not taken yet
+    size_t get_ready_bytes_count() const;
+    const BYTE* get_ready_bytes() const;
+    size_t take_bytes(BYTE* dest, size_t count);
+};
+
+inline void bit_writer::flush_word()
+{
+    if (buffer_size + 4 > buffer_capacity)
+    {
+        grow(buffer_size + 4);
+    }
+    uint32_t word = accumulator >> 32;
+    buffer[buffer_size++] = word >> 24;
+    buffer[buffer_size++] = word >> 16;
+    buffer[buffer_size++] = word >> 8;
+    buffer[buffer_size++] = word;
+    accumulator <<= 32;
+    accumulator_size -= 32;
+}
+
+inline void bit_writer::write_bits(uint64_t value, unsigned int count)
+{
+    if (count == 0)
+    {
+        return;
+    }
+    value &= 0xFFFFFFFFFFFFFFFFull >> (64 - count);
+    accumulator |= value << (64 - accumulator_size - count);
+    accumulator_size += count;
+    if (accumulator_size >= 32)
+    {
+        flush_word();
+    }
+}
+
+inline void bit_writer::write_zeros(uint64_t count)
+{
+    while (count > 0)
+    {
+        unsigned int step = count > 32 ? 32 : static_cast<unsigned int>(count);
+        accumulator_size += step;
+        count -= step;
+        if (accumulator_size >= 32)
+        {
+            flush_word();
+        }
+    }
+}
+
+inline void bit_writer::write_unary(uint64_t count)
+{
+    write_zeros(count);
+    write_bits(1, 1);
+}
+
+inline size_t bit_writer::get_bits_count() const
+{
+    return (taken_size + buffer_size) * 8 + accumulator_size;
+}
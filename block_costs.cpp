@@ -0,0 +1,304 @@
+#include "pch.h"
+#include "block_costs.h"
+#include "helpers.h"
+#include "cpu_features.h"
+#include <bit>
+
+// Above this resolution a 32-bit lane summing 16 samples may overflow
+constexpr unsigned int max_vector_resolution = 28;
+// Second Extension only wins for blocks that are almost all zeros and ones
+constexpr uint64_t second_extension_threshold = 1;
+
+// A pair on a longer diagonal alone outweighs any uncompressed block. Its size
+// is capped so that a block of 32 pairs of 32-bit samples cannot overflow, by
+// every kernel alike, since the reference correction mixes their results.
+constexpr uint64_t max_pair_diagonal = 1 << 20;
+
+static uint64_t get_pair_size(uint64_t sample_a, uint64_t sample_b)
+{
+    uint64_t diagonal = get_min(sample_a + sample_b, max_pair_diagonal);
+    return diagonal * (diagonal + 1) / 2 + sample_b + 1;
+}
+
+// Every kernel is compiled for the block size and the number of options it
+// sums, so that both loops have fixed trip counts and the option loop unrolls
+struct scalar_costs
+{
+    template<size_t block_size, unsigned int k_count, bool with_pairs>
+    static void compute(const uint32_t* block, unsigned int first_k, uint64_t* shifted_sums, uint64_t* pairs_size, bool& all_zero)
+    {
+        uint32_t any = 0;
+        uint64_t pairs = 0;
+        uint64_t sums[k_count] = {};
+        for (size_t i = 0; i < block_size; i += 2)
+        {
+            uint32_t sample_a = block[i];
+            uint32_t sample_b = block[i + 1];
+            any |= sample_a | sample_b;
+            for (unsigned int j = 0; j < k_count; ++j)
+            {
+                sums[j] += uint64_t{ sample_a >> (first_k + j) } + (sample_b >> (first_k + j));
+            }
+            if constexpr (with_pairs)
+            {
+                pairs += get_pair_size(sample_a, sample_b);
+            }
+        }
+        for (unsigned int j = 0; j < k_count; ++j)
+        {
+            shifted_sums[first_k + j] = sums[j];
+        }
+        if constexpr (with_pairs)
+        {
+            *pairs_size = pairs;
+        }
+        all_zero = any == 0;
+    }
+};
+
+#ifdef SIMD_X86
+struct avx2_costs
+{
+    template<size_t block_size, unsigned int k_count, bool with_pairs>
+    TARGET_AVX2 static void compute(const uint32_t* block, unsigned int first_k, uint64_t* shifted_sums, uint64_t* pairs_size, bool& all_zero)
+    {
+        __m256i sums[k_count];
+        __m128i shifts[k_count];
+        for (unsigned int j = 0; j < k_count; ++j)
+        {
+            sums[j] = _mm256_setzero_si256();
+            shifts[j] = _mm_cvtsi32_si128(first_k + j);
+        }
+        const __m256i ones = _mm256_set1_epi64x(1);
+        const __m256i low_half = _mm256_set1_epi64x(0xFFFFFFFF);
+        const __m256i max_diagonal = _mm256_set1_epi64x(max_pair_diagonal);
+        __m256i any = _mm256_setzero_si256();
+        __m256i pairs = _mm256_setzero_si256();
+        for (size_t i = 0; i < block_size; i += 8)
+        {
+            __m256i samples = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + i));
+            any = _mm256_or_si256(any, samples);
+            for (unsigned int j = 0; j < k_count; ++j)
+            {
+                sums[j] = _mm256_add_epi32(sums[j], _mm256_srl_epi32(samples, shifts[j]));
+            }
+            if constexpr (with_pairs)
+            {
+                // every 64-bit lane holds one (a, b) pair
+                __m256i sample_a = _mm256_and_si256(samples, low_half);
+                __m256i sample_b = _mm256_srli_epi64(samples, 32);
+                // the sums fit the low halves, so a 32-bit minimum caps them
+                __m256i diagonal = _mm256_min_epu32(_mm256_add_epi64(sample_a, sample_b), max_diagonal);
+                __m256i triangle = _mm256_srli_epi64(_mm256_mul_epu32(diagonal, _mm256_add_epi64(diagonal, ones)), 1);
+                pairs = _mm256_add_epi64(pairs, _mm256_add_epi64(_mm256_add_epi64(triangle, sample_b), ones));
+            }
+        }
+        alignas(32) uint32_t lanes[8];
+        for (unsigned int j = 0; j < k_count; ++j)
+        {
+            _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), sums[j]);
+            uint64_t sum = 0;
+            for (uint32_t lane : lanes)
+            {
+                sum += lane;
+            }
+            shifted_sums[first_k + j] = sum;
+        }
+        if constexpr (with_pairs)
+        {
+            alignas(32) uint64_t pair_lanes[4];
+            _mm256_store_si256(reinterpret_cast<__m256i*>(pair_lanes), pairs);
+            *pairs_size = pair_lanes[0] + pair_lanes[1] + pair_lanes[2] + pair_lanes[3];
+        }
+        all_zero = _mm256_testz_si256(any, any);
+    }
+};
+
+struct sse41_costs
+{
+    template<size_t block_size, unsigned int k_count, bool with_pairs>
+    TARGET_SSE41 static void compute(const uint32_t* block, unsigned int first_k, uint64_t* shifted_sums, uint64_t* pairs_size, bool& all_zero)
+    {
+        __m128i sums[k_count];
+        __m128i shifts[k_count];
+        for (unsigned int j = 0; j < k_count; ++j)
+        {
+            sums[j] = _mm_setzero_si128();
+            shifts[j] = _mm_cvtsi32_si128(first_k + j);
+        }
+        const __m128i ones = _mm_set1_epi64x(1);
+        const __m128i low_half = _mm_set1_epi64x(0xFFFFFFFF);
+        const __m128i max_diagonal = _mm_set1_epi64x(max_pair_diagonal);
+        __m128i any = _mm_setzero_si128();
+        __m128i pairs = _mm_setzero_si128();
+        for (size_t i = 0; i < block_size; i += 4)
+        {
+            __m128i samples = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + i));
+            any = _mm_or_si128(any, samples);
+            for (unsigned int j = 0; j < k_count; ++j)
+            {
+                sums[j] = _mm_add_epi32(sums[j], _mm_srl_epi32(samples, shifts[j]));
+            }
+            if constexpr (with_pairs)
+            {
+                __m128i sample_a = _mm_and_si128(samples, low_half);
+                __m128i sample_b = _mm_srli_epi64(samples, 32);
+                __m128i diagonal = _mm_min_epu32(_mm_add_epi64(sample_a, sample_b), max_diagonal);
+                __m128i triangle = _mm_srli_epi64(_mm_mul_epu32(diagonal, _mm_add_epi64(diagonal, ones)), 1);
+                pairs = _mm_add_epi64(pairs, _mm_add_epi64(_mm_add_epi64(triangle, sample_b), ones));
+            }
+        }
+        alignas(16) uint32_t lanes[4];
+        for (unsigned int j = 0; j < k_count; ++j)
+        {
+            _mm_store_si128(reinterpret_cast<__m128i*>(lanes), sums[j]);
+            shifted_sums[first_k + j] = uint64_t{ lanes[0] } + lanes[1] + lanes[2] + lanes[3];
+        }
+        if constexpr (with_pairs)
+        {
+            alignas(16) uint64_t pair_lanes[2];
+            _mm_store_si128(reinterpret_cast<__m128i*>(pair_lanes), pairs);
+            *pairs_size = pair_lanes[0] + pair_lanes[1];
+        }
+        all_zero = _mm_testz_si128(any, any);
+    }
+};
+#endif
+
+// Resolution classes up to 2, 4, 8, 16, 24 and 32 bits, the first ones share
+// the option ID size. Their split options are k = 0 to 0, 1, 5, 13, 24 and 29.
+constexpr size_t resolution_classes_count = 6;
+
+static size_t get_resolution_class(unsigned int sample_resolution)
+{
+    if (sample_resolution <= 2)
+        return 0;
+    if (sample_resolution <= 4)
+        return 1;
+    if (sample_resolution <= 8)
+        return 2;
+    if (sample_resolution <= 16)
+        return 3;
+    if (sample_resolution <= 24)
+        return 4;
+    return 5;
+}
+
+struct sized_kernels
+{
+    std::array<costs_kernel, resolution_classes_count> all_options;
+    std::array<costs_kernel, 3> range;
+};
+
+template<typename isa, size_t block_size>
+static constexpr sized_kernels make_sized_kernels()
+{
+    return {
+        { isa::template compute<block_size, 1, true>, isa::template compute<block_size, 2, true>, isa::template compute<block_size, 6, true>,
+            isa::template compute<block_size, 14, true>, isa::template compute<block_size, 25, true>, isa::template compute<block_size, 30, true> },
+        { isa::template compute<block_size, 1, false>, isa::template compute<block_size, 2, false>, isa::template compute<block_size, 3, false> } };
+}
+
+// kernel tables indexed by log2(block_size) - 3
+using isa_kernels = std::array<sized_kernels, 4>;
+
+template<typename isa>
+static constexpr isa_kernels make_isa_kernels()
+{
+    return { make_sized_kernels<isa, 8>(), make_sized_kernels<isa, 16>(), make_sized_kernels<isa, 32>(), make_sized_kernels<isa, 64>() };
+}
+
+static constexpr isa_kernels scalar_kernels = make_isa_kernels<scalar_costs>();
+#ifdef SIMD_X86
+static constexpr isa_kernels avx2_kernels = make_isa_kernels<avx2_costs>();
+static constexpr isa_kernels sse41_kernels = make_isa_kernels<sse41_costs>();
+#endif
+
+static const isa_kernels& select_vector_kernels()
+{
+#ifdef SIMD_X86
+    if (cpu_supports_avx2())
+    {
+        return avx2_kernels;
+    }
+    if (cpu_supports_sse41())
+    {
+        return sse41_kernels;
+    }
+#endif
+    return scalar_kernels;
+}
+
+costs_kernels get_costs_kernels(unsigned int sample_resolution, unsigned int block_size)
+{
+    static const isa_kernels& vector_kernels = select_vector_kernels();
+    const isa_kernels& kernels = sample_resolution <= max_vector_resolution ? vector_kernels : scalar_kernels;
+    const sized_kernels& sized = kernels[std::countr_zero(block_size) - 3];
+    return { sized.all_options[get_resolution_class(sample_resolution)], sized.range };
+}
+
+void compute_block_costs(const costs_kernels& kernels, const uint32_t* block, size_t block_size, unsigned int max_k, unsigned int prefix_size, bool reference, block_costs& costs)
+{
+    uint64_t shifted_sums[max_split_options];
+    uint64_t pairs_size = 0;
+    kernels.all_options(block, 0, shifted_sums, &pairs_size, costs.all_zero);
+
+    // the first sample of a reference block is replaced by the reference value
+    if (reference)
+    {
+        pairs_size = pairs_size - get_pair_size(block[0], block[1]) + get_pair_size(0, block[1]);
+    }
+    costs.second_extension_size = prefix_size + 1 + pairs_size;
+    for (unsigned int j = 0; j <= max_k; ++j)
+    {
+        costs.k_sizes[j] = prefix_size + block_size * (j + 1) + shifted_sums[j];
+    }
+}
+
+static size_t get_second_extension_size(const uint32_t* block, size_t block_size, unsigned int prefix_size, bool reference, size_t best_size)
+{
+    size_t result = prefix_size + 1;
+    for (size_t i = 0; i < block_size && result <= best_size; i += 2)
+    {
+        uint64_t sample_a = block[i];
+        if (reference && i == 0)
+        {
+            sample_a = 0;
+        }
+        result += get_pair_size(sample_a, block[i + 1]);
+    }
+    return result <= best_size ? result : skipped_option_size;
+}
+
+void estimate_block_costs(const costs_kernels& kernels, const uint32_t* block, size_t block_size, unsigned int max_k, unsigned int prefix_size, bool reference, size_t best_size, block_costs& costs)
+{
+    uint64_t shifted_sums[max_split_options];
+    kernels.range[0](block, 0, shifted_sums, nullptr, costs.all_zero);
+    costs.k_sizes.fill(skipped_option_size);
+    costs.second_extension_size = skipped_option_size;
+    if (costs.all_zero)
+    {
+        return;
+    }
+
+    // k = floor(log2(mean)), the optimum lies within one of it
+    uint64_t sum = shifted_sums[0];
+    unsigned int k = std::bit_width(sum / block_size);
+    k = k == 0 ? 0 : get_min(k - 1, max_k);
+    unsigned int first_k = k == 0 ? 0 : k - 1;
+    unsigned int last_k = get_min(k + 1, max_k);
+    kernels.range[last_k - first_k](block, first_k, shifted_sums, nullptr, costs.all_zero);
+    for (unsigned int j = first_k; j <= last_k; ++j)
+    {
+        costs.k_sizes[j] = prefix_size + block_size * (j + 1) + shifted_sums[j];
+        if (costs.k_sizes[j] < best_size)
+        {
+            best_size = costs.k_sizes[j];
+        }
+    }
+
+    if (sum <= second_extension_threshold * block_size)
+    {
+        costs.second_extension_size = get_second_extension_size(block, block_size, prefix_size, reference, best_size);
+    }
+}
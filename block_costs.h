@@ -0,0 +1,47 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <cstddef>
+
+constexpr size_t max_split_options = 30;
+// Options whose size was not evaluated or exceeded the best one found so far
+constexpr size_t skipped_option_size = SIZE_MAX;
+
+// Sizes in bits of every coding option for one preprocessed block, option ID
+// prefix included. k_sizes[0] is Fundamental Sequence.
+struct block_costs
+{
+    std::array<size_t, max_split_options> k_sizes;
+    size_t second_extension_size;
+    bool all_zero;
+};
+
+// Sums sample >> k into shifted_sums[k] for a number of consecutive k from
+// first_k that the kernel is compiled for. Kernels of every option also sum the
+// Second Extension pair sizes into pairs_size.
+using costs_kernel = void (*)(const uint32_t* block, unsigned int first_k, uint64_t* shifted_sums, uint64_t* pairs_size, bool& all_zero);
+
+// Kernels compiled for one block size and resolution class, with fixed trip
+// counts
+struct costs_kernels
+{
+    // every split option of the resolution class from k = 0, pairs included
+    costs_kernel all_options;
+    // range[i] sums i + 1 options, without pairs
+    std::array<costs_kernel, 3> range;
+};
+
+// Uses AVX2 or SSE4.1 when the CPU supports them and the sample resolution
+// keeps the 32-bit lane sums from overflowing, the scalar kernels otherwise.
+// Meant to be picked once per encoder.
+costs_kernels get_costs_kernels(unsigned int sample_resolution, unsigned int block_size);
+
+// Evaluates all options in a single pass over the block.
+void compute_block_costs(const costs_kernels& kernels, const uint32_t* block, size_t block_size, unsigned int max_k, unsigned int prefix_size, bool reference, block_costs& costs);
+
+// Heuristic variant of compute_block_costs. Estimates k from the sum of the
+// block, evaluates only k - 1, k and k + 1, and Second Extension only for
+// blocks whose mean is at most second_extension_threshold. Second Extension
+// stops being accumulated once it exceeds best_size or the best split option.
+// Every option that was not evaluated is skipped_option_size.
+void estimate_block_costs(const costs_kernels& kernels, const uint32_t* block, size_t block_size, unsigned int max_k, unsigned int prefix_size, bool reference, size_t best_size, block_costs& costs);
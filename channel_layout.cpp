@@ -0,0 +1,133 @@
+#include "pch.h"
+#include "channel_layout.h"
+#include "Encoder.h"
+#include "helpers.h"
+#include "sample_unpacker.h"
+#include "sample_packer.h"
+#include <exception>
+
+// Samples are moved in chunks that start at byte boundaries of every buffer
+static constexpr size_t chunk_samples_count = 4096;
+static constexpr size_t interleaved_chunk_samples_count = 64;
+
+std::vector<BYTE> write_channel_table(unsigned int layout, const std::vector<size_t>& stream_sizes)
+{
+    std::vector<BYTE> table;
+    table.reserve(channel_table_header_size + stream_sizes.size() * channel_table_entry_size);
+    table.push_back(static_cast<BYTE>(stream_sizes.size() >> 8));
+    table.push_back(static_cast<BYTE>(stream_sizes.size()));
+    table.push_back(static_cast<BYTE>(layout));
+    for (size_t size : stream_sizes)
+    {
+        write_uint64(table, size);
+    }
+    return table;
+}
+
+std::vector<channel_stream> read_channel_table(const BYTE* data, size_t data_size, unsigned int& layout)
+{
+    if (data_size < channel_table_header_size)
+    {
+        throw std::exception{};
+    }
+    size_t channels_count = (size_t{ data[0] } << 8) | data[1];
+    layout = data[2];
+    if (channels_count < 2 || layout >= layouts_count)
+    {
+        throw std::exception{};
+    }
+    size_t table_size = channel_table_header_size + channels_count * channel_table_entry_size;
+    if (data_size < table_size)
+    {
+        throw std::exception{};
+    }
+
+    std::vector<channel_stream> streams(channels_count);
+    size_t offset = table_size;
+    for (size_t i = 0; i < channels_count; ++i)
+    {
+        uint64_t size = read_uint64(data + channel_table_header_size + i * channel_table_entry_size);
+        if (size > data_size - offset)
+        {
+            throw std::exception{};
+        }
+        streams[i] = { data + offset, static_cast<size_t>(size) };
+        offset += size;
+    }
+    if (offset != data_size)
+    {
+        throw std::exception{};
+    }
+    return streams;
+}
+
+void split_channels(const BYTE* data, size_t data_size, unsigned int sample_resolution, unsigned int layout,
+    size_t channels_count, size_t channel_samples_count, BYTE* const* channels)
+{
+    unpack_kernel unpack_samples = get_unpack_kernel(sample_resolution);
+    std::vector<uint32_t> samples(chunk_samples_count);
+    size_t samples_count = channels_count * channel_samples_count;
+    for (size_t first = 0; first < samples_count; first += chunk_samples_count)
+    {
+        size_t count = get_min(chunk_samples_count, samples_count - first);
+        size_t first_byte = first * sample_resolution / 8;
+        unpack_samples(data + first_byte, data_size - first_byte, sample_resolution, samples.data(), count);
+        // every channel receives its samples in order, as pack_sample requires
+        for (size_t i = 0; i < count; ++i)
+        {
+            size_t sample_i = first + i;
+            size_t channel = layout == layout_interleaved ? sample_i % channels_count : sample_i / channel_samples_count;
+            size_t channel_sample_i = layout == layout_interleaved ? sample_i / channels_count : sample_i % channel_samples_count;
+            pack_sample(channels[channel], channel_sample_i * sample_resolution, samples[i], sample_resolution);
+        }
+    }
+}
+
+void merge_channels(const BYTE* const* channels, unsigned int sample_resolution, unsigned int layout,
+    size_t channels_count, size_t channel_samples_count, BYTE* dest)
+{
+    unpack_kernel unpack_samples = get_unpack_kernel(sample_resolution);
+    size_t channel_size = (channel_samples_count * sample_resolution + 7) / 8;
+    if (layout == layout_sequential)
+    {
+        std::vector<uint32_t> samples(chunk_samples_count);
+        size_t dest_bit = 0;
+        for (size_t channel = 0; channel < channels_count; ++channel)
+        {
+            for (size_t first = 0; first < channel_samples_count; first += chunk_samples_count)
+            {
+                size_t count = get_min(chunk_samples_count, channel_samples_count - first);
+                size_t first_byte = first * sample_resolution / 8;
+                unpack_samples(channels[channel] + first_byte, channel_size - first_byte, sample_resolution, samples.data(), count);
+                for (size_t i = 0; i < count; ++i)
+                {
+                    pack_sample(dest, dest_bit, samples[i], sample_resolution);
+                    dest_bit += sample_resolution;
+                }
+            }
+        }
+        return;
+    }
+
+    // a few samples of every channel at a time, then written out row by row
+    std::vector<uint32_t> samples(channels_count * interleaved_chunk_samples_count);
+    size_t dest_bit = 0;
+    for (size_t first = 0; first < channel_samples_count; first += interleaved_chunk_samples_count)
+    {
+        size_t count = get_min(interleaved_chunk_samples_count, channel_samples_count - first);
+        size_t first_byte = first * sample_resolution / 8;
+        for (size_t channel = 0; channel < channels_count; ++channel)
+        {
+            unpack_samples(channels[channel] + first_byte, channel_size - first_byte, sample_resolution,
+                samples.data() + channel * interleaved_chunk_samples_count, count);
+        }
+        for (size_t i = 0; i < count; ++i)
+        {
+            for (size_t channel = 0; channel < channels_count; ++channel)
+            {
+                pack_sample(dest, dest_bit, samples[channel * interleaved_chunk_samples_count + i], sample_resolution);
+                dest_bit += sample_resolution;
+            }
+        }
+    }
+}
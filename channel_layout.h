@@ -0,0 +1,32 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include "Byte.h"
+
+// Multichannel data is encoded as one complete stream per channel, header
+// included, behind a channel table. Header byte 5 flags it, the header's
+// sample count covers every channel. The table holds the channels count (16
+// bits), the layout (8 bits) and the size of every channel stream (64 bits
+// each), all big-endian.
+constexpr BYTE header_flag_multichannel = 0b00100000;
+constexpr size_t channel_table_header_size = 3;
+constexpr size_t channel_table_entry_size = 8;
+
+struct channel_stream
+{
+    const BYTE* data;
+    size_t size;
+};
+
+std::vector<BYTE> write_channel_table(unsigned int layout, const std::vector<size_t>& stream_sizes);
+// data follows the header, the channel streams follow the table
+std::vector<channel_stream> read_channel_table(const BYTE* data, size_t data_size, unsigned int& layout);
+
+// Copies the samples of every channel out of data into channels[c], packed
+// back to back, channel_samples_count samples each
+void split_channels(const BYTE* data, size_t data_size, unsigned int sample_resolution, unsigned int layout,
+    size_t channels_count, size_t channel_samples_count, BYTE* const* channels);
+// inverse of split_channels
+void merge_channels(const BYTE* const* channels, unsigned int sample_resolution, unsigned int layout,
+    size_t channels_count, size_t channel_samples_count, BYTE* dest);
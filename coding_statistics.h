@@ -0,0 +1,36 @@
+#pragma once
+#include <cstdint>
+
+// Coding options counted by coding_statistics
+enum coding_option
+{
+    option_zero_block = 0,
+    option_second_extension = 1,
+    option_fundamental_sequence = 2,
+    option_no_compression = 3,
+    option_split_sample = 4,  // option_split_sample + k - 1 for split sample k
+};
+constexpr unsigned int max_split_sample_k = 29;
+constexpr unsigned int coding_options_count = option_split_sample + max_split_sample_k;
+
+// How the blocks of the data encoded or decoded last were coded. The bits of
+// an option cover its ID and its coded samples, reference samples are counted
+// apart. Every block of a zero block run is counted.
+struct coding_statistics
+{
+    uint64_t blocks[coding_options_count];
+    uint64_t bits[coding_options_count];
+    uint64_t reference_blocks;
+    uint64_t reference_bits;
+};
+
+inline void add_coding_statistics(coding_statistics& total, const coding_statistics& part)
+{
+    for (unsigned int i = 0; i < coding_options_count; ++i)
+    {
+        total.blocks[i] += part.blocks[i];
+        total.bits[i] += part.bits[i];
+    }
+    total.reference_blocks += part.reference_blocks;
+    total.reference_bits += part.reference_bits;
+}
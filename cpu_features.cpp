@@ -0,0 +1,37 @@
+#include "pch.h"
+#include "cpu_features.h"
+
+#ifdef SIMD_X86
+bool cpu_supports_avx2()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+    {
+        return false;
+    }
+    __cpuid(info, 1);
+    bool os_saves_ymm = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 0b110) == 0b110;
+    if (!os_saves_ymm)
+    {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return info[1] & (1 << 5);
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+bool cpu_supports_sse41()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    return info[2] & (1 << 19);
+#else
+    return __builtin_cpu_supports("sse4.1");
+#endif
+}
+#endif
@@ -0,0 +1,19 @@
+#pragma once
+
+// x86 kernels are compiled for AVX2 or SSE4.1 individually and picked at run
+// time with cpu_supports_avx2 and cpu_supports_sse41.
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define TARGET_AVX2
+#define TARGET_SSE41
+#else
+#include <immintrin.h>
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_SSE41 __attribute__((target("sse4.1")))
+#endif
+
+bool cpu_supports_avx2();
+bool cpu_supports_sse41();
+#endif
@@ -2,6 +2,32 @@
 #include "decoding_machine.h"
 #include "helpers.h"
 #include <fstream>
+#include <array>
+#include <cmath>
+#include <algorithm>
+#include <bit>
+
+// Second Extension codewords are only chosen when they are shorter than the
+// uncompressed block (at most 64 * 32 + 5 bits), so every pair the encoder
+// emits lies on one of the first 64 diagonals.
+static constexpr size_t pair_table_diagonals = 64;
+static constexpr size_t pair_table_size = pair_table_diagonals * (pair_table_diagonals + 1) / 2;
+
+static constexpr std::array<std::pair<uint32_t, uint32_t>, pair_table_size> make_pair_table()
+{
+	std::array<std::pair<uint32_t, uint32_t>, pair_table_size> table{};
+	size_t i = 0;
+	for (uint32_t diagonal = 0; diagonal < pair_table_diagonals; ++diagonal)
+	{
+		for (uint32_t sample_b = 0; sample_b <= diagonal; ++sample_b)
+		{
+			table[i++] = { diagonal - sample_b, sample_b };
+		}
+	}
+	return table;
+}
+
+static constexpr auto pair_table = make_pair_table();
 
 size_t decoding_machine::get_decoded_bits_count()
 {
@@ -23,9 +49,71 @@ std::vector<BYTE> decoding_machine::get_decoded_data()
 
 void decoding_machine::feed_data_from_file(const std::string& filename)
 {
-	std::ifstream file = std::ifstream{ filename, std::ifstream::in | std::ifstream::binary };
-	init_from_file(file);
-	read_data_from_file(file);
+	source_file.open(filename);
+	init_from_encoded(source_file.get_data(), source_file.get_size());
+}
+
+void decoding_machine::feed_data(const BYTE* data, size_t data_size)
+{
+	source_file.close();
+	init_from_encoded(data, data_size);
+}
+
+size_t decoding_machine::get_decoded_size() const
+{
+	return (sample_count * sample_resolution + 7) / 8;
+}
+
+size_t decoding_machine::write_decoded(BYTE* dest, size_t dest_size)
+{
+	if (dest_size < get_decoded_size())
+	{
+		throw std::exception{};
+	}
+	if (data_decoded)
+	{
+		std::copy(decoded_data.begin(), decoded_data.begin() + get_decoded_size(), dest);
+	}
+	else
+	{
+		decode_into(dest, get_decoded_size());
+	}
+	return get_decoded_size();
+}
+
+void decoding_machine::init_from_encoded(const BYTE* data, size_t data_size)
+{
+	if (data_size < header_size)
+	{
+		throw std::exception{};
+	}
+	streaming = false;
+	init_from_header(data);
+	encoded_data = data + header_size;
+	encoded_data_size = data_size - header_size;
+	segments.clear();
+	channel_streams.clear();
+	if (multichannel)
+	{
+		channel_streams = read_channel_table(encoded_data, encoded_data_size, layout);
+		if (sample_count % channel_streams.size() != 0)
+		{
+			throw std::exception{};
+		}
+	}
+	if (has_index)
+	{
+		segments = read_seek_index(encoded_data, encoded_data_size);
+		for (const auto& segment : segments)
+		{
+			if (segment.first_sample >= sample_count || segment.first_sample % block_size != 0)
+			{
+				throw std::exception{};
+			}
+		}
+	}
+	decoded_data.clear();
+	data_decoded = false;
 }
 
 void decoding_machine::save_to_file(const std::string& filename)
@@ -42,116 +130,575 @@ void decoding_machine::save_to_file(const std::string& filename)
 	}
 }
 
+void decoding_machine::start_stream()
+{
+	source_file.close();
+	encoded_data = nullptr;
+	encoded_data_size = 0;
+	decoded_data.clear();
+	data_decoded = false;
+	segments.clear();
+	streaming = true;
+	header_read = false;
+	stream_input_finished = false;
+	stream_input.clear();
+	stream_position = 0;
+	stream_decoded_bits = 0;
+	stream_read_bytes = 0;
+	stream_samples_left = 0;
+	stream_block_i = 0;
+	stream_last_block_pending = false;
+	statistics = {};
+}
+
+void decoding_machine::push_data(const BYTE* data, size_t data_size)
+{
+	if (!streaming || stream_input_finished)
+	{
+		throw std::exception{};
+	}
+	// drop the input that was decoded already, but the last block's until
+	// its statistics are complete
+	size_t dropped_bytes_count = (stream_last_block_pending ? stream_last_block.position : stream_position) / 8;
+	stream_input.erase(stream_input.begin(), stream_input.begin() + dropped_bytes_count);
+	stream_position -= dropped_bytes_count * 8;
+	stream_last_block.position -= stream_last_block_pending ? dropped_bytes_count * 8 : 0;
+	stream_input.insert(stream_input.end(), data, data + data_size);
+
+	if (!header_read && stream_input.size() >= header_size)
+	{
+		init_from_header(stream_input.data());
+		// the references are only known from the trailer, the channels from
+		// the sizes of all of them
+		if (adaptive_reference || multichannel)
+		{
+			throw std::exception{};
+		}
+		stream_input.erase(stream_input.begin(), stream_input.begin() + header_size);
+		stream_samples_left = sample_count;
+		header_read = true;
+	}
+}
+
+void decoding_machine::finish_stream()
+{
+	if (!streaming)
+	{
+		throw std::exception{};
+	}
+	if (!header_read)
+	{
+		throw std::exception{};
+	}
+	stream_input_finished = true;
+	if (stream_last_block_pending)
+	{
+		bit_reader reader{ stream_input.data(), stream_input.size() };
+		size_t last_bit;
+		if (find_block_end(reader, stream_last_block.position, stream_last_block.samples_to_read_count, stream_last_block.block_i, last_bit))
+		{
+			statistics.bits[stream_last_block.option] += last_bit - stream_last_block.position - stream_last_block.counted_bits_count;
+		}
+		stream_last_block_pending = false;
+	}
+}
+
+size_t decoding_machine::read_stream_bytes(BYTE* dest, size_t count)
+{
+	if (!streaming)
+	{
+		throw std::exception{};
+	}
+	decode_stream(stream_read_bytes + count);
+	count = get_min(count, get_stream_ready_bytes_count() - stream_read_bytes);
+	std::copy(decoded_data.begin() + stream_read_bytes, decoded_data.begin() + stream_read_bytes + count, dest);
+	stream_read_bytes += count;
+
+	// move the rest to the front once read bytes dominate the buffer
+	if (stream_read_bytes * 2 >= get_stream_ready_bytes_count())
+	{
+		decoded_data.erase(decoded_data.begin(), decoded_data.begin() + stream_read_bytes);
+		stream_decoded_bits -= stream_read_bytes * 8;
+		stream_read_bytes = 0;
+	}
+	return count;
+}
+
+bool decoding_machine::is_stream_done() const
+{
+	return header_read && stream_samples_left <= 0 && stream_read_bytes == get_stream_ready_bytes_count();
+}
+
+size_t decoding_machine::get_stream_ready_bytes_count() const
+{
+	// the last byte is complete only once every sample is decoded
+	if (header_read && stream_samples_left <= 0)
+	{
+		return (stream_decoded_bits + 7) / 8;
+	}
+	return stream_decoded_bits / 8;
+}
+
+void decoding_machine::decode_stream(size_t bytes_count)
+{
+	if (!header_read)
+	{
+		return;
+	}
+	output = decoded_data.data();
+	output_size = decoded_data.size();
+	output_growable = true;
+	bit_reader reader{ stream_input.data(), stream_input.size() };
+	reader.set_position(stream_position);
+	while (stream_samples_left > 0 && stream_decoded_bits / 8 < bytes_count)
+	{
+		// a unit cut by the end of the pushed input is decoded again later
+		size_t position = reader.get_position();
+		size_t decoded_bits = stream_decoded_bits;
+		int64_t samples_left = stream_samples_left;
+		size_t block_i = stream_block_i;
+		reverse_preprocessor saved_reverser = reverser;
+		coding_statistics saved_statistics = statistics;
+		try
+		{
+			decode_next_unit(reader, stream_decoded_bits, stream_samples_left, stream_block_i);
+		}
+		catch (const std::exception&)
+		{
+			if (stream_input_finished)
+			{
+				throw;
+			}
+			reader.set_position(position);
+			stream_decoded_bits = decoded_bits;
+			stream_samples_left = samples_left;
+			stream_block_i = block_i;
+			reverser = saved_reverser;
+			statistics = saved_statistics;
+			break;
+		}
+	}
+	stream_position = reader.get_position();
+}
+
+void decoding_machine::set_threads_count(unsigned int threads_count)
+{
+	this->threads_count = threads_count;
+	pool.reset();
+	if (threads_count > 1)
+	{
+		pool = std::make_unique<thread_pool>(threads_count);
+	}
+}
+
 void decoding_machine::decode_data()
 {
-	size_t i_encoded = 0;
+	decoded_data.resize(get_decoded_size());
+	decode_into(decoded_data.data(), decoded_data.size());
+	data_decoded = true;
+}
+
+void decoding_machine::decode_into(BYTE* dest, size_t dest_size)
+{
+	if (dest_size < get_decoded_size())
+	{
+		throw std::exception{};
+	}
+	output = dest;
+	output_size = dest_size;
+	output_growable = false;
+	statistics = {};
+	if (multichannel)
+	{
+		decode_channels();
+		return;
+	}
+	if (segments.size() > 1 && threads_count != 1)
+	{
+		decode_data_parallel();
+		return;
+	}
+	bit_reader reader{ encoded_data, encoded_data_size };
 	size_t i_decoded = 0;
-	size_t read_sample_count = 0;
 	int64_t samples_to_read_count = sample_count;
-	size_t prefix_size = get_prefix_size();
-	size_t reference_sample_interval = 4096;
 	size_t block_i = 0;
 
 	while (samples_to_read_count > 0)
 	{
-		// get block encoding type
-		size_t prefix = 0;
-		bool extended_prefix = false;
-		for (int j = 0; j < prefix_size; ++j)
+		decode_next_unit(reader, i_decoded, samples_to_read_count, block_i);
+	}
+}
+
+// Segments listed in the seek index start at byte boundaries of the decoded
+// data, since they hold whole blocks of at least 8 samples each, so every
+// segment is packed straight into its own part of the output.
+void decoding_machine::decode_data_parallel()
+{
+	std::vector<coding_statistics> segment_statistics(segments.size());
+	thread_pool& segments_pool = pool ? *pool : thread_pool::get_shared();
+	segments_pool.run(segments.size(), [this, &segment_statistics](size_t i) {
+		size_t first_sample = segments[i].first_sample;
+		size_t end_sample = i + 1 < segments.size() ? segments[i + 1].first_sample : sample_count;
+		size_t first_byte = first_sample * sample_resolution / 8;
+		size_t end_byte = (end_sample * sample_resolution + 7) / 8;
+		segment_statistics[i] = decode_segment(i, end_sample - first_sample, output + first_byte, end_byte - first_byte);
+	});
+	for (const auto& part : segment_statistics)
+	{
+		add_coding_statistics(statistics, part);
+	}
+}
+
+// Channel streams are complete streams of their own, every one is decoded
+// apart and their samples are merged back into the layout they came from.
+void decoding_machine::decode_channels()
+{
+	size_t channels_count = channel_streams.size();
+	size_t channel_samples_count = sample_count / channels_count;
+	std::vector<std::vector<BYTE>> channels(channels_count);
+	std::vector<coding_statistics> channel_statistics(channels_count);
+	auto decode_channel = [&](size_t i) {
+		decoding_machine channel;
+		channel.feed_data(channel_streams[i].data, channel_streams[i].size);
+		// the padding of a channel's last byte may hold zero samples past its end
+		if (channel.multichannel || channel.sample_resolution != sample_resolution || channel.sample_count < channel_samples_count)
 		{
-			prefix <<= 1;
-			if (get_bit(encoded_data, i_encoded++))
-			{
-				prefix |= 1;
-			}
+			throw std::exception{};
 		}
-		if (prefix == 0)
+		channels[i].resize(channel.get_decoded_size());
+		channel.decode_into(channels[i].data(), channels[i].size());
+		channel_statistics[i] = channel.statistics;
+	};
+	if (threads_count == 1)
+	{
+		for (size_t i = 0; i < channels_count; ++i)
 		{
-			extended_prefix = true;
-			prefix <<= 1;
-			if (get_bit(encoded_data, i_encoded++))
-			{
-				prefix |= 1;
-			}
+			decode_channel(i);
 		}
+	}
+	else
+	{
+		thread_pool& channels_pool = pool ? *pool : thread_pool::get_shared();
+		channels_pool.run(channels_count, decode_channel);
+	}
 
-		// read reference value for revercing preprocessor
-		bool reference = block_i % reference_sample_interval == 0;
-		if (reference)
-		{
-			uint32_t reference = 0;
-			for (int i = 0; i < sample_resolution; ++i)
-			{
-				reference <<= 1;
-				bool val = get_bit(encoded_data, i_encoded++);
-				set_bit(decoded_data, i_decoded++, val);
-				if (val)
-				{
-					reference |= 1;
-				}
-			}
-			reverser.set_reference(reference);
-		}
+	for (const auto& part : channel_statistics)
+	{
+		add_coding_statistics(statistics, part);
+	}
+
+	std::vector<const BYTE*> channel_data(channels_count);
+	for (size_t i = 0; i < channels_count; ++i)
+	{
+		channel_data[i] = channels[i].data();
+	}
+	merge_channels(channel_data.data(), sample_resolution, layout, channels_count, channel_samples_count, output);
+}
 
-		// decode samples
-		if (prefix == (1 << prefix_size) - 1)  // no compression
+coding_statistics decoding_machine::decode_segment(size_t segment_i, size_t samples_count, BYTE* dest, size_t dest_size) const
+{
+	decoding_machine segment;
+	segment.sample_resolution = sample_resolution;
+	segment.block_size = block_size;
+	segment.prefix_size = prefix_size;
+	segment.decode_specialized_unit = decode_specialized_unit;
+	segment.reference_sample_interval = reference_sample_interval;
+	segment.adaptive_reference = adaptive_reference;
+	segment.reverser.set_sample_resolution(sample_resolution);
+	segment.reverser.set_predictor(reverser.get_predictor());
+	if (adaptive_reference)
+	{
+		size_t end_sample = segments[segment_i].first_sample + samples_count;
+		for (size_t i = segment_i; i < segments.size() && segments[i].first_sample < end_sample; ++i)
 		{
-			auto decoded_samples_count = decode_no_compression(i_encoded, i_decoded, samples_to_read_count, reference);
-			if (reference)
-			{
-				decoded_samples_count += 1;
-			}
-			samples_to_read_count -= decoded_samples_count;
-			block_i += decoded_samples_count / block_size;
+			segment.segments.push_back(segments[i]);
 		}
-		else if (prefix == 0)  // Zero-Block
+	}
+	bit_reader reader{ encoded_data, encoded_data_size };
+	reader.set_position(segments[segment_i].bit_offset);
+	size_t i_decoded = 0;
+	int64_t samples_to_read_count = samples_count;
+	size_t block_i = segments[segment_i].first_sample / block_size;
+	segment.output = dest;
+	segment.output_size = dest_size;
+	while (samples_to_read_count > 0)
+	{
+		segment.decode_next_unit(reader, i_decoded, samples_to_read_count, block_i);
+	}
+	return segment.statistics;
+}
+
+void decoding_machine::reserve_output(size_t bits_count)
+{
+	size_t bytes_count = (bits_count + 7) / 8;
+	if (bytes_count <= output_size)
+	{
+		return;
+	}
+	if (!output_growable)
+	{
+		throw std::exception{};
+	}
+	size_t grown_size = decoded_data.size() * 2 + 64;
+	decoded_data.resize(grown_size > bytes_count ? grown_size : bytes_count);
+	output = decoded_data.data();
+	output_size = decoded_data.size();
+}
+
+const coding_statistics& decoding_machine::get_statistics() const
+{
+	return statistics;
+}
+
+size_t decoding_machine::get_sample_count() const
+{
+	return sample_count;
+}
+
+void decoding_machine::decode_range(size_t first_sample, size_t count, BYTE* dest)
+{
+	if ((encoded_data == nullptr && sample_count != 0) || multichannel || first_sample > sample_count || count > sample_count - first_sample)
+	{
+		throw std::exception{};
+	}
+	if (count == 0)
+	{
+		return;
+	}
+	if (segments.empty())
+	{
+		scan_segments();
+	}
+	auto segment = std::upper_bound(segments.begin(), segments.end(), first_sample,
+		[](size_t sample, const seek_index_entry& entry) { return sample < entry.first_sample; }) - 1;
+	size_t segment_i = segment - segments.begin();
+	size_t skipped_bits = (first_sample - segment->first_sample) * sample_resolution;
+	size_t decoded_samples_count = first_sample + count - segment->first_sample;
+	std::vector<BYTE> decoded((decoded_samples_count * sample_resolution + 7) / 8);
+	decode_segment(segment_i, decoded_samples_count, decoded.data(), decoded.size());
+
+	// shift the window to the first bit of dest
+	size_t bytes_count = (count * sample_resolution + 7) / 8;
+	size_t byte_i = skipped_bits / 8;
+	unsigned int shift = skipped_bits % 8;
+	for (size_t i = 0; i < bytes_count; ++i)
+	{
+		unsigned int value = decoded[byte_i + i] << shift;
+		if (shift != 0 && byte_i + i + 1 < decoded.size())
 		{
-			auto decoded_samples_count = decode_zero_block(i_encoded, i_decoded, samples_to_read_count, reference);
-			if (reference)
-			{
-				decoded_samples_count += 1;
-			}
-			samples_to_read_count -= decoded_samples_count;
-			block_i += decoded_samples_count / block_size;
+			value |= decoded[byte_i + i + 1] >> (8 - shift);
 		}
-		else if (extended_prefix)  // Second-Extension
+		dest[i] = static_cast<BYTE>(value);
+	}
+	unsigned int tail_bits = (count * sample_resolution) % 8;
+	if (tail_bits != 0)
+	{
+		dest[bytes_count - 1] &= static_cast<BYTE>(0xFF << (8 - tail_bits));
+	}
+}
+
+// Walks the block structure without reconstructing samples to find where
+// every reference sample segment starts, for files without a seek index.
+void decoding_machine::scan_segments()
+{
+	bit_reader reader{ encoded_data, encoded_data_size };
+	int64_t samples_to_read_count = sample_count;
+	size_t block_i = 0;
+	segments.clear();
+	while (samples_to_read_count > 0)
+	{
+		if (is_reference_block(block_i))
 		{
-			auto decoded_samples_count = decode_second_extension(i_encoded, i_decoded, samples_to_read_count, reference);
-			if (reference)
-			{
-				decoded_samples_count += 1;
-			}
-			samples_to_read_count -= decoded_samples_count;
-			block_i += decoded_samples_count / block_size;
+			segments.push_back({ reader.get_position(), block_i * block_size });
 		}
-		else if (prefix == 1) // fundamental sequence
+		skip_next_unit(reader, samples_to_read_count, block_i);
+	}
+}
+
+bool decoding_machine::is_reference_block(size_t block_i) const
+{
+	if (block_i % reference_sample_interval == 0)
+	{
+		return true;
+	}
+	if (!adaptive_reference)
+	{
+		return false;
+	}
+	size_t first_sample = block_i * block_size;
+	auto segment = std::lower_bound(segments.begin(), segments.end(), first_sample,
+		[](const seek_index_entry& entry, size_t sample) { return entry.first_sample < sample; });
+	return segment != segments.end() && segment->first_sample == first_sample;
+}
+
+void decoding_machine::skip_next_unit(bit_reader& reader, int64_t& samples_to_read_count, size_t& block_i)
+{
+	size_t prefix = reader.read_bits(prefix_size);
+	bool extended_prefix = false;
+	if (prefix == 0)
+	{
+		extended_prefix = true;
+		prefix = reader.read_bit();
+	}
+	bool reference = is_reference_block(block_i);
+	if (reference)
+	{
+		reader.skip(sample_resolution);
+	}
+	size_t codes_count = reference ? block_size - 1 : block_size;
+	size_t decoded_samples_count = get_min<size_t>(block_size, samples_to_read_count);
+
+	if (prefix == (size_t{ 1 } << prefix_size) - 1)  // no compression
+	{
+		reader.skip(codes_count * sample_resolution);
+	}
+	else if (prefix == 0)  // Zero-Block
+	{
+		size_t trailing_zeroes_count = reader.read_unary();
+		size_t zero_blocks_count = trailing_zeroes_count < 4 ? trailing_zeroes_count + 1 : trailing_zeroes_count;
+		decoded_samples_count = get_min<size_t>(zero_blocks_count * block_size, samples_to_read_count);
+	}
+	else if (extended_prefix)  // Second-Extension
+	{
+		for (size_t i = 0; i < block_size / 2; ++i)
 		{
-			auto decoded_samples_count = decode_fundamental_sequence(i_encoded, i_decoded, samples_to_read_count, reference);
-			if (reference)
-			{
-				decoded_samples_count += 1;
-			}
-			samples_to_read_count -= decoded_samples_count;
-			block_i += decoded_samples_count / block_size;
+			reader.read_unary();
 		}
-		else  // split sample
+	}
+	else  // fundamental sequence and split sample
+	{
+		for (size_t i = 0; i < codes_count; ++i)
 		{
-			auto decoded_samples_count = decode_k(i_encoded, i_decoded, prefix - 1, samples_to_read_count, reference);
-			if (reference)
-			{
-				decoded_samples_count += 1;
-			}
-			samples_to_read_count -= decoded_samples_count;
-			block_i += decoded_samples_count / block_size;
+			reader.read_unary();
 		}
+		reader.skip(codes_count * (prefix - 1));
 	}
-	data_decoded = true;
+	samples_to_read_count -= decoded_samples_count;
+	block_i += decoded_samples_count / block_size;
 }
 
-void decoding_machine::init_from_file(std::ifstream& in)
+bool decoding_machine::find_block_end(bit_reader reader, size_t first_bit, int64_t samples_to_read_count, size_t block_i, size_t& last_bit)
+{
+	reader.set_position(first_bit);
+	try
+	{
+		skip_next_unit(reader, samples_to_read_count, block_i);
+	}
+	catch (const std::exception&)
+	{
+		return false;
+	}
+	if (reader.get_position() > reader.get_bits_count())
+	{
+		return false;
+	}
+	last_bit = reader.get_position();
+	return true;
+}
+
+void decoding_machine::decode_next_unit(bit_reader& reader, size_t& i_decoded, int64_t& samples_to_read_count, size_t& block_i)
+{
+	(this->*decode_specialized_unit)(reader, i_decoded, samples_to_read_count, block_i);
+}
+
+template<size_t fixed_block_size, size_t fixed_prefix_size>
+void decoding_machine::decode_unit(bit_reader& reader, size_t& i_decoded, int64_t& samples_to_read_count, size_t& block_i)
+{
+	size_t first_bit = reader.get_position();
+	size_t first_block_i = block_i;
+	int64_t first_samples_to_read_count = samples_to_read_count;
+	// get block encoding type
+	size_t prefix = reader.read_bits(fixed_prefix_size);
+	bool extended_prefix = false;
+	if (prefix == 0)
+	{
+		extended_prefix = true;
+		prefix = reader.read_bit();
+	}
+
+	// read reference value for revercing preprocessor
+	bool reference = is_reference_block(block_i);
+	if (reference)
+	{
+		uint32_t reference = reader.read_bits(sample_resolution);
+		reserve_output(i_decoded + sample_resolution);
+		pack_sample(output, i_decoded, reference, sample_resolution);
+		i_decoded += sample_resolution;
+		reverser.set_reference(reference);
+	}
+
+	// decode samples
+	size_t decoded_samples_count;
+	unsigned int option;
+	if (prefix == (size_t{ 1 } << fixed_prefix_size) - 1)  // no compression
+	{
+		decoded_samples_count = decode_no_compression<fixed_block_size>(reader, i_decoded, samples_to_read_count, reference);
+		option = option_no_compression;
+	}
+	else if (prefix == 0)  // Zero-Block
+	{
+		decoded_samples_count = decode_zero_block(reader, i_decoded, samples_to_read_count, reference);
+		option = option_zero_block;
+	}
+	else if (extended_prefix)  // Second-Extension
+	{
+		decoded_samples_count = decode_second_extension<fixed_block_size>(reader, i_decoded, samples_to_read_count, reference);
+		option = option_second_extension;
+	}
+	else if (prefix == 1) // fundamental sequence
+	{
+		decoded_samples_count = decode_fundamental_sequence<fixed_block_size>(reader, i_decoded, samples_to_read_count, reference);
+		option = option_fundamental_sequence;
+	}
+	else  // split sample
+	{
+		decoded_samples_count = decode_k<fixed_block_size>(reader, i_decoded, prefix - 1, samples_to_read_count, reference);
+		option = option_split_sample + static_cast<unsigned int>(prefix) - 2;
+	}
+	if (reference)
+	{
+		decoded_samples_count += 1;
+	}
+	samples_to_read_count -= decoded_samples_count;
+	block_i += decoded_samples_count / fixed_block_size;
+
+	// the last block is coded whole, the codes past the data are walked over
+	// to count them as the encoder does
+	size_t last_bit = reader.get_position();
+	if (option != option_zero_block && decoded_samples_count % fixed_block_size != 0
+		&& !find_block_end(reader, first_bit, first_samples_to_read_count, first_block_i, last_bit)
+		&& streaming && !stream_input_finished)
+	{
+		// a stream may not hold the rest of the block yet, it is counted
+		// once the stream is finished
+		stream_last_block = { first_bit, first_samples_to_read_count, first_block_i, option, last_bit - first_bit };
+		stream_last_block_pending = true;
+	}
+	size_t bits_count = last_bit - first_bit;
+	if (reference)
+	{
+		statistics.reference_blocks += 1;
+		statistics.reference_bits += sample_resolution;
+		bits_count -= sample_resolution;
+	}
+	// a zero block run may end with the data in a partial block
+	statistics.blocks[option] += (decoded_samples_count + fixed_block_size - 1) / fixed_block_size;
+	statistics.bits[option] += bits_count;
+}
+
+decoding_machine::unit_decoder decoding_machine::get_unit_decoder(size_t block_size, size_t prefix_size)
+{
+	// indexed by log2(block_size) - 3 and prefix_size - 1
+	static constexpr unit_decoder unit_decoders[4][5]{
+		{ &decoding_machine::decode_unit<8, 1>, &decoding_machine::decode_unit<8, 2>, &decoding_machine::decode_unit<8, 3>, &decoding_machine::decode_unit<8, 4>, &decoding_machine::decode_unit<8, 5> },
+		{ &decoding_machine::decode_unit<16, 1>, &decoding_machine::decode_unit<16, 2>, &decoding_machine::decode_unit<16, 3>, &decoding_machine::decode_unit<16, 4>, &decoding_machine::decode_unit<16, 5> },
+		{ &decoding_machine::decode_unit<32, 1>, &decoding_machine::decode_unit<32, 2>, &decoding_machine::decode_unit<32, 3>, &decoding_machine::decode_unit<32, 4>, &decoding_machine::decode_unit<32, 5> },
+		{ &decoding_machine::decode_unit<64, 1>, &decoding_machine::decode_unit<64, 2>, &decoding_machine::decode_unit<64, 3>, &decoding_machine::decode_unit<64, 4>, &decoding_machine::decode_unit<64, 5> } };
+	return unit_decoders[std::countr_zero(block_size) - 3][prefix_size - 1];
+}
+
+void decoding_machine::init_from_header(const BYTE* header)
 {
-	BYTE header[12];
-	in.read((char*)header, 12);
 	if (header[0] != 0b01110000)
 		throw std::exception{};
 	if (header[1] != 0b00100000)
@@ -159,11 +706,22 @@ void decoding_machine::init_from_file(std::ifstream& in)
 	if (header[2] & 0b11100000)
 		throw std::exception{};
 	sample_resolution = header[2] + 1;
+	has_index = header[5] & header_flag_seek_index;
+	adaptive_reference = header[5] & header_flag_adaptive_reference;
+	multichannel = header[5] & header_flag_multichannel;
+	if (adaptive_reference && !has_index)
+		throw std::exception{};
 	reverser.set_sample_resolution(sample_resolution);
+	unsigned int predictor = (header[5] & header_predictor_mask) >> header_predictor_shift;
+	if (predictor >= predictors_count)
+		throw std::exception{};
+	reverser.set_predictor(predictor);
+	prefix_size = get_prefix_size();
 	if (header[3] & 0b10000000 || !(header[3] & 0b00010000))
 		throw std::exception{};
 	block_size = (header[3] & 0b01100000) >> 5;
 	block_size = 8ull << block_size;
+	decode_specialized_unit = get_unit_decoder(block_size, prefix_size);
 	reference_sample_interval = 0;
 	for (int i = 0; i < 4; ++i)
 	{
@@ -175,6 +733,7 @@ void decoding_machine::init_from_file(std::ifstream& in)
 		reference_sample_interval <<= 1;
 		reference_sample_interval |= (header[4] >> (7 - i)) & 1;
 	}
+	reference_sample_interval += 1;
 	sample_count = 0;
 	for (int i = 0; i < 48; ++i)
 	{
@@ -183,32 +742,6 @@ void decoding_machine::init_from_file(std::ifstream& in)
 	}
 }
 
-void decoding_machine::read_data_from_file(std::ifstream& in)
-{
-	encoded_data.clear();
-	decoded_data.clear();
-	data_decoded = false;
-	do
-	{
-		BYTE in_buf[64];
-		in.read((char*)in_buf, 64);
-		if (in)
-		{
-			for (int i = 0; i < sizeof(in_buf) / sizeof(BYTE); ++i)
-			{
-				encoded_data.push_back(in_buf[i]);
-			}
-		}
-		else
-		{
-			for (int i = 0; i < in.gcount(); ++i)
-			{
-				encoded_data.push_back(in_buf[i]);
-			}
-		}
-	} while (in);
-}
-
 size_t decoding_machine::get_prefix_size()
 {
 	if (sample_resolution <= 2)
@@ -221,182 +754,160 @@ size_t decoding_machine::get_prefix_size()
 		return 4;
 	if (sample_resolution <= 32)
 		return 5;
+	throw std::exception{};
 }
 
-size_t decoding_machine::decode_no_compression(size_t& i_encoded, size_t& i_decoded, size_t samples_left, bool reference)
+template<size_t fixed_block_size>
+size_t decoding_machine::decode_no_compression(bit_reader& reader, size_t& i_decoded, size_t samples_left, bool reference)
 {
-	size_t required_samples_count = min(block_size, samples_left);
+	size_t required_samples_count = get_min(fixed_block_size, samples_left);
 	if (reference)
 	{
 		required_samples_count -= 1;
 	}
-
-	for (int i = 0; i < required_samples_count; ++i)
+	std::array<uint32_t, max_block_size> mapped;
+	for (size_t i = 0; i < required_samples_count; ++i)
 	{
-		uint32_t sample = 0;
-		for (int j = 0; j < sample_resolution; ++j)
-		{
-			sample <<= 1;
-			if (get_bit(encoded_data, i_encoded++))
-			{
-				sample |= 1;
-			}
-		}
-		sample = reverser.get_value(sample);
-		for (int j = 1; j <= sample_resolution; ++j)
-		{
-			bool value = (sample >> (sample_resolution - j)) & 1;
-			set_bit(decoded_data, i_decoded++, value);
-		}
+		mapped[i] = reader.read_bits(sample_resolution);
 	}
+	write_samples(mapped.data(), required_samples_count, i_decoded);
 	return required_samples_count;
 }
 
-size_t decoding_machine::decode_zero_block(size_t& i_encoded, size_t& i_decoded, size_t samples_left, bool reference)
+size_t decoding_machine::decode_zero_block(bit_reader& reader, size_t& i_decoded, size_t samples_left, bool reference)
 {
-	size_t trailing_zeroes_count = 0;
-	while (!get_bit(encoded_data, i_encoded++))
-	{
-		trailing_zeroes_count += 1;
-	}
+	size_t trailing_zeroes_count = reader.read_unary();
 	size_t zero_blocks_count = trailing_zeroes_count;
 	if (trailing_zeroes_count < 4)
 	{
 		zero_blocks_count += 1;
 	}
-	size_t samples_count = min(zero_blocks_count * block_size, samples_left);
+	size_t samples_count = get_min(zero_blocks_count * block_size, samples_left);
 	if (reference)
 	{
 		samples_count -= 1;
 	}
-	uint32_t sample = reverser.get_value(0);
-	for (int i = 0; i < samples_count; ++i)
+	reserve_output(i_decoded + samples_count * sample_resolution);
+	if (reverser.get_predictor() != predictor_unit_delay)
 	{
-		for (int j = 1; j <= sample_resolution; ++j)
+		// zero errors follow the prediction, which need not stay constant
+		static constexpr std::array<uint32_t, max_block_size> zeroes{};
+		for (size_t i = 0; i < samples_count; i += max_block_size)
 		{
-			bool value = (sample >> (sample_resolution - j)) & 1;
-			set_bit(decoded_data, i_decoded++, value);
+			write_samples(zeroes.data(), get_min(max_block_size, samples_count - i), i_decoded);
 		}
+		return samples_count;
+	}
+	uint32_t sample = reverser.get_value(0);
+	for (size_t i = 0; i < samples_count; ++i)
+	{
+		pack_sample(output, i_decoded, sample, sample_resolution);
+		i_decoded += sample_resolution;
 	}
 
 	return samples_count;
 }
 
-size_t decoding_machine::decode_second_extension(size_t& i_encoded, size_t& i_decoded, size_t samples_left, bool reference)
+template<size_t fixed_block_size>
+size_t decoding_machine::decode_second_extension(bit_reader& reader, size_t& i_decoded, size_t samples_left, bool reference)
 {
-	size_t required_samples_count = min(samples_left, block_size);
+	size_t required_samples_count = get_min(samples_left, fixed_block_size);
 	if (reference)
 	{
 		required_samples_count -= 1;
 	}
+	std::array<uint32_t, max_block_size> mapped;
 	size_t sample_i = 0;
 	while(sample_i < required_samples_count)
 	{
-		uint64_t sample = 0;
-		while (!get_bit(encoded_data, i_encoded++))
-		{
-			sample += 1;
-		}
+		uint64_t sample = reader.read_unary();
 		auto [sample_1, sample_2] = unpack_samples(sample);
 		if (!(sample_i == 0 && reference))
 		{
-			sample_1 = reverser.get_value(sample_1);
-			for (int j = 1; j <= sample_resolution; ++j)
-			{
-				set_bit(decoded_data, i_decoded++, (sample_1 >> (sample_resolution - j)) & 1);
-			}
-			++sample_i;
+			mapped[sample_i++] = sample_1;
 		}
 		if (sample_i < required_samples_count)
 		{
-			sample_2 = reverser.get_value(sample_2);
-			for (int j = 1; j <= sample_resolution; ++j)
-			{
-				set_bit(decoded_data, i_decoded++, (sample_2 >> (sample_resolution - j)) & 1);
-			}
-			++sample_i;
+			mapped[sample_i++] = sample_2;
 		}
 	}
+	write_samples(mapped.data(), required_samples_count, i_decoded);
 	return required_samples_count;
 }
 
-size_t decoding_machine::decode_fundamental_sequence(size_t& i_encoded, size_t& i_decoded, size_t samples_left, bool reference)
+template<size_t fixed_block_size>
+size_t decoding_machine::decode_fundamental_sequence(bit_reader& reader, size_t& i_decoded, size_t samples_left, bool reference)
 {
-	size_t required_samples_count = min(samples_left, block_size);
+	size_t required_samples_count = get_min(samples_left, fixed_block_size);
 	if (reference)
 	{
 		required_samples_count -= 1;
 	}
-	for (int i = 0; i < required_samples_count; ++i)
+	std::array<uint32_t, max_block_size> mapped;
+	for (size_t i = 0; i < required_samples_count; ++i)
 	{
-		uint32_t sample = 0;
-		while (!get_bit(encoded_data, i_encoded++))
-		{
-			sample += 1;
-		}
-		sample = reverser.get_value(sample);
-		for (int j = 1; j <= sample_resolution; ++j)
-		{
-			set_bit(decoded_data, i_decoded++, (sample >> (sample_resolution - j)) & 1);
-		}
+		mapped[i] = static_cast<uint32_t>(reader.read_unary());
 	}
+	write_samples(mapped.data(), required_samples_count, i_decoded);
 	return required_samples_count;
 }
 
-size_t decoding_machine::decode_k(size_t& i_encoded, size_t& i_decoded, size_t k, size_t samples_left, bool reference)
+template<size_t fixed_block_size>
+size_t decoding_machine::decode_k(bit_reader& reader, size_t& i_decoded, size_t k, size_t samples_left, bool reference)
 {
-	size_t required_samples_count = min(samples_left, block_size);
-	size_t actual_block_size = block_size;
+	size_t required_samples_count = get_min(samples_left, fixed_block_size);
+	size_t actual_block_size = fixed_block_size;
 	if (reference)
 	{
 		required_samples_count -= 1;
 		actual_block_size -= 1;
 	}
-	std::vector<size_t> elder_bits{};
-	elder_bits.resize(required_samples_count);
-	for (int i = 0; i < actual_block_size; ++i)
+	std::array<uint32_t, max_block_size> mapped;
+	for (size_t i = 0; i < actual_block_size; ++i)
 	{
-		size_t sample = 0;
-		while (!get_bit(encoded_data, i_encoded++))
-		{
-			sample += 1;
-		}
+		uint64_t sample = reader.read_unary();
 		if (i < required_samples_count)
 		{
-			elder_bits[i] = sample << k;
+			mapped[i] = static_cast<uint32_t>(sample << k);
 		}
 	}
-	for (int i = 0; i < required_samples_count; ++i)
+	for (size_t i = 0; i < required_samples_count; ++i)
 	{
-		uint32_t sample = 0;
-		for (int j = 0; j < k; ++j)
-		{
-			sample <<= 1;
-			if (get_bit(encoded_data, i_encoded++))
-			{
-				sample |= 1;
-			}
-		}
-		sample |= elder_bits[i];
-		sample = reverser.get_value(sample);
-		for (int j = 1; j <= sample_resolution; ++j)
-		{
-			set_bit(decoded_data, i_decoded++, (sample >> (sample_resolution - j)) & 1);
-		}
+		mapped[i] |= reader.read_bits(k);
 	}
+	write_samples(mapped.data(), required_samples_count, i_decoded);
 	return required_samples_count;
 }
 
+void decoding_machine::write_samples(const uint32_t* mapped, size_t samples_count, size_t& i_decoded)
+{
+	std::array<uint32_t, max_block_size> samples;
+	reverser.get_values(mapped, samples.data(), samples_count);
+	reserve_output(i_decoded + samples_count * sample_resolution);
+	for (size_t i = 0; i < samples_count; ++i)
+	{
+		pack_sample(output, i_decoded, samples[i], sample_resolution);
+		i_decoded += sample_resolution;
+	}
+}
+
 std::pair<uint32_t, uint32_t> decoding_machine::unpack_samples(uint64_t sample)
 {
-	uint64_t diagonal_i = 0;
-	uint64_t min_value = 0;
-	while (sample >= min_value)
+	if (sample < pair_table_size)
+	{
+		return pair_table[sample];
+	}
+	// sample = d * (d + 1) / 2 + b, where d = a + b
+	uint64_t diagonal = static_cast<uint64_t>((std::sqrt(8.0 * static_cast<double>(sample) + 1) - 1) / 2);
+	while (diagonal * (diagonal + 1) / 2 > sample)
+	{
+		--diagonal;
+	}
+	while ((diagonal + 1) * (diagonal + 2) / 2 <= sample)
 	{
-		min_value += diagonal_i++ + 1;
+		++diagonal;
 	}
-	--diagonal_i;
-	uint32_t sample_a = (min_value - 1) - sample;
-	uint32_t sample_b = diagonal_i - sample_a;
+	uint32_t sample_b = sample - diagonal * (diagonal + 1) / 2;
+	uint32_t sample_a = diagonal - sample_b;
 	return std::pair<uint32_t, uint32_t>{sample_a, sample_b};
 }
@@ -1,35 +1,133 @@
 #pragma once
 #include <vector>
 #include "Byte.h"
+#include "Encoder.h"
 #include <string>
 #include "reverse_preprocessor.h"
+#include "bit_reader.h"
+#include "mapped_file.h"
+#include "seek_index.h"
+#include "channel_layout.h"
+#include "sample_packer.h"
+#include "thread_pool.h"
+#include "coding_statistics.h"
+#include <memory>
 
 class decoding_machine
 {
 private:
+	static constexpr size_t header_size = 12;
+
 	size_t sample_resolution = 0;
 	size_t block_size = 0;
+	// option ID bits, fixed by the resolution class
+	size_t prefix_size = 0;
+	using unit_decoder = void (decoding_machine::*)(bit_reader& reader, size_t& i_decoded, int64_t& samples_to_read_count, size_t& block_i);
+	// decode_unit for the block size and the prefix size, picked by init_from_header
+	unit_decoder decode_specialized_unit = nullptr;
 	size_t reference_sample_interval = 0;
 	size_t sample_count = 0;
 	std::vector<BYTE> decoded_data;
-	std::vector<BYTE> encoded_data;
+	// samples are packed here, into decoded_data or the caller's buffer
+	BYTE* output = nullptr;
+	size_t output_size = 0;
+	// only the streaming output grows, the others are sized from the header
+	bool output_growable = false;
+	mapped_file source_file;
+	const BYTE* encoded_data = nullptr;
+	size_t encoded_data_size = 0;
 	bool data_decoded = false;
+	coding_statistics statistics{};
 	reverse_preprocessor reverser;
+	bool has_index = false;
+	bool adaptive_reference = false;
+	std::vector<seek_index_entry> segments;
+	bool multichannel = false;
+	unsigned int layout = 0;
+	std::vector<channel_stream> channel_streams;
+	// 1 decodes on the calling thread, 0 uses the shared pool
+	unsigned int threads_count = 1;
+	std::unique_ptr<thread_pool> pool;
+
+	// streaming state, decoded_data only holds the bytes not read yet
+	bool streaming = false;
+	bool header_read = false;
+	bool stream_input_finished = false;
+	std::vector<BYTE> stream_input;
+	size_t stream_position = 0;
+	size_t stream_decoded_bits = 0;
+	size_t stream_read_bytes = 0;
+	int64_t stream_samples_left = 0;
+	size_t stream_block_i = 0;
+	// the final block decoded before the input holding all of its codes
+	struct pending_block
+	{
+		size_t position;
+		int64_t samples_to_read_count;
+		size_t block_i;
+		unsigned int option;
+		size_t counted_bits_count;
+	};
+	pending_block stream_last_block{};
+	bool stream_last_block_pending = false;
 public:
 	size_t get_decoded_bits_count();
 	std::vector<BYTE> get_decoded_data();
 	void feed_data_from_file(const std::string& filename);
+	// borrows data, it has to outlive the decoding
+	void feed_data(const BYTE* data, size_t data_size);
+	size_t get_decoded_size() const;
+	size_t write_decoded(BYTE* dest, size_t dest_size);
 	void save_to_file(const std::string& filename);
 	void decode_data();
+	void set_threads_count(unsigned int threads_count);
+	size_t get_sample_count() const;
+	// count samples starting at first_sample, packed like the decoded data
+	void decode_range(size_t first_sample, size_t count, BYTE* dest);
+
+	// Streaming: encoded bytes are pushed in chunks of any size, blocks are
+	// decoded only as the decoded bytes are read, so memory stays bounded by
+	// the pushed chunk and a single block run.
+	void start_stream();
+	void push_data(const BYTE* data, size_t data_size);
+	void finish_stream();
+	size_t read_stream_bytes(BYTE* dest, size_t count);
+	bool is_stream_done() const;
+	const coding_statistics& get_statistics() const;
 private:
-	void init_from_file(std::ifstream& in);
-	void read_data_from_file(std::ifstream& in);
+	void decode_into(BYTE* dest, size_t dest_size);
+	void decode_data_parallel();
+	void decode_channels();
+	// returns the statistics of the segment
+	coding_statistics decode_segment(size_t segment_i, size_t samples_count, BYTE* dest, size_t dest_size) const;
+	void reserve_output(size_t bits_count);
+	void scan_segments();
+	bool is_reference_block(size_t block_i) const;
+	void skip_next_unit(bit_reader& reader, int64_t& samples_to_read_count, size_t& block_i);
+	// walks the unit at first_bit over the codes of its whole block, false
+	// when the input ends first
+	bool find_block_end(bit_reader reader, size_t first_bit, int64_t samples_to_read_count, size_t block_i, size_t& last_bit);
+	void decode_next_unit(bit_reader& reader, size_t& i_decoded, int64_t& samples_to_read_count, size_t& block_i);
+	// decode_next_unit compiled for one block size and option ID size
+	template<size_t fixed_block_size, size_t fixed_prefix_size>
+	void decode_unit(bit_reader& reader, size_t& i_decoded, int64_t& samples_to_read_count, size_t& block_i);
+	static unit_decoder get_unit_decoder(size_t block_size, size_t prefix_size);
+	void decode_stream(size_t bytes_count);
+	size_t get_stream_ready_bytes_count() const;
+	void init_from_header(const BYTE* header);
+	void init_from_encoded(const BYTE* data, size_t data_size);
 	size_t get_prefix_size();
-	size_t decode_no_compression(size_t& i_encoded, size_t& i_decoded, size_t samples_left, bool reference);
-	size_t decode_zero_block(size_t& i_encoded, size_t& i_decoded, size_t samples_left, bool reference);
-	size_t decode_second_extension(size_t& i_encoded, size_t& i_decoded, size_t samples_left, bool reference);
-	size_t decode_fundamental_sequence(size_t& i_encoded, size_t& i_decoded, size_t samples_left, bool reference);
-	size_t decode_k(size_t& i_encoded, size_t& i_decoded, size_t k, size_t samples_left, bool reference);
+	template<size_t fixed_block_size>
+	size_t decode_no_compression(bit_reader& reader, size_t& i_decoded, size_t samples_left, bool reference);
+	size_t decode_zero_block(bit_reader& reader, size_t& i_decoded, size_t samples_left, bool reference);
+	template<size_t fixed_block_size>
+	size_t decode_second_extension(bit_reader& reader, size_t& i_decoded, size_t samples_left, bool reference);
+	template<size_t fixed_block_size>
+	size_t decode_fundamental_sequence(bit_reader& reader, size_t& i_decoded, size_t samples_left, bool reference);
+	template<size_t fixed_block_size>
+	size_t decode_k(bit_reader& reader, size_t& i_decoded, size_t k, size_t samples_left, bool reference);
+	// reverses the preprocessing of a block's samples and packs them
+	void write_samples(const uint32_t* mapped, size_t samples_count, size_t& i_decoded);
 	std::pair<uint32_t, uint32_t> unpack_samples(uint64_t sample);
 };
 
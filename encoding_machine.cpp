@@ -1,5 +1,8 @@
 #include "pch.h"
 #include "encoding_machine.h"
+#include <bit>
+#include <cstring>
+#include <cstdlib>
 
 unsigned int get_max_k(unsigned int sample_resolution)
 {
@@ -10,8 +13,8 @@ unsigned int get_max_k(unsigned int sample_resolution)
     if (sample_resolution <= 8)
         return 5u;
     if (sample_resolution <= 16)
-        return min(sample_resolution, 13u);
-    return min(sample_resolution, 29u);
+        return get_min(sample_resolution, 13u);
+    return get_min(sample_resolution, 29u);
 }
 
 unsigned int get_no_compression_prefix(unsigned int sample_resolution)
@@ -42,77 +45,27 @@ unsigned int get_no_compression_prefix_size(unsigned int sample_resolution)
 
 void encoding_machine::feed_data_from_file(const std::string& filename)
 {
-    in_file.open(filename, std::ifstream::in | std::ifstream::binary);
-    std::ifstream in = std::ifstream{ filename, std::ifstream::in | std::ifstream::binary };
-
-    this->was_encoded = false;
+    streaming = false;
+    source_file.open(filename);
     source_data.clear();
-    encoded_data.clear();
-    do
-    {
-        BYTE in_buf[64];
-        in.read((char*)in_buf, 64);
-        if (in)
-        {
-            for (int i = 0; i < sizeof(in_buf) / sizeof(BYTE); ++i)
-            {
-                source_data.push_back(in_buf[i]);
-            }
-        }
-        else
-        {
-            for (int i = 0; i < in.gcount(); ++i)
-            {
-                source_data.push_back(in_buf[i]);
-            }
-        }
-    } while (in);
-}
-
-size_t encoding_machine::get_second_extension_size(const std::vector<uint32_t>& block, bool reference)
-{
-    size_t result = no_compression_prefix_size + 1;
-    for (int i = 1; i <= block.size() / 2; ++i)
-    {
-        size_t i1 = (i * 2) - 2;
-        size_t i2 = (i * 2) - 1;
-        uint64_t sample_a = block[i1];
-        if (reference && i == 1)
-        {
-            sample_a = 0;
-        }
-        uint64_t sample_b = block[i2];
-        uint64_t sample = (sample_a + sample_b) * (sample_a + sample_b + 1) / 2 + sample_b;
-        result += sample + 1;
-    }
-    return result;
-}
+    input = source_file.get_data();
+    input_size = source_file.get_size();
 
-
-std::vector<uint64_t> encoding_machine::get_second_extension_block(const std::vector<uint32_t>& block, bool reference)
-{
-    std::vector<uint64_t> result;
-    for (int i = 1; i <= block.size() / 2; ++i)
-    {
-        size_t i1 = (i * 2) - 2;
-        size_t i2 = (i * 2) - 1;
-        uint64_t sample_a = block[i1];
-        if (reference && i == 1)
-        {
-            sample_a = 0;
-        }
-        uint64_t sample_b = block[i2];
-        uint64_t sample = (sample_a + sample_b) * (sample_a + sample_b + 1) / 2 + sample_b;
-        result.push_back(sample);
-    }
-    return result;
+    this->was_encoded = false;
+    output.clear();
 }
 
-encoding_machine::encoding_machine(unsigned int sample_resolution, unsigned int block_size)
+encoding_machine::encoding_machine(unsigned int sample_resolution, unsigned int block_size, unsigned int selection, unsigned int reference_interval, unsigned int reference,
+    unsigned int predictor, unsigned int channels_count, unsigned int layout)
     : 
-    preprocessor{ new unit_delay_preprocesson{sample_resolution} },
     sample_resolution{ sample_resolution },
-    block_size{ block_size }
+    block_size{ block_size },
+    selection{ selection },
+    reference_interval{ reference_interval },
+    reference{ reference },
+    predictor{ predictor },
+    channels_count{ channels_count },
+    layout{ layout }
 {
     if (sample_resolution == 0 || sample_resolution > 32)
     {
@@ -122,92 +75,454 @@ encoding_machine::encoding_machine(unsigned int sample_resolution, unsigned int
     {
         throw std::exception{};
     }
+    if (selection != selection_exact && selection != selection_fast)
+    {
+        throw std::exception{};
+    }
+    if (reference_interval == 0 || reference_interval > max_reference_interval)
+    {
+        throw std::exception{};
+    }
+    if (reference != reference_fixed && reference != reference_adaptive)
+    {
+        throw std::exception{};
+    }
+    if (predictor >= predictors_count)
+    {
+        throw std::exception{};
+    }
+    if (channels_count == 0 || channels_count > max_channels_count || layout >= layouts_count)
+    {
+        throw std::exception{};
+    }
+    if (predictor == predictor_unit_delay)
+    {
+        sample_preprocessor = std::make_unique<unit_delay_preprocesson>(sample_resolution);
+    }
+    else
+    {
+        sample_preprocessor = std::make_unique<predicting_preprocessor>(predictor, sample_resolution);
+    }
+    adaptive_segment_bits = size_t{ reference_interval } * block_size * sample_resolution / 8;
     no_compression_prefix_size = get_no_compression_prefix_size(sample_resolution);
     no_compression_prefix = get_no_compression_prefix(sample_resolution);
     max_k = get_max_k(sample_resolution);
+    unpack_samples = get_unpack_kernel(sample_resolution);
+    block_costs_kernels = get_costs_kernels(sample_resolution, block_size);
+}
+
+void encoding_machine::feed_data(std::vector<BYTE> data)
+{
+    streaming = false;
+    source_file.close();
+    this->source_data = std::move(data);
+    input = source_data.data();
+    input_size = source_data.size();
+    this->was_encoded = false;
 }
 
-void encoding_machine::feed_data(const std::vector<BYTE>& data)
+void encoding_machine::feed_data(const BYTE* data, size_t data_size)
 {
-    this->source_data = data;
+    streaming = false;
+    source_file.close();
+    source_data.clear();
+    input = data;
+    input_size = data_size;
     this->was_encoded = false;
 }
 
 void encoding_machine::encode_data()
 {
-    std::vector<BYTE> result;
-    size_t bit_i = 0;
-    size_t zero_blocks_count = 0;
-    bool zero_block_needs_ref = false;
-    uint32_t zero_block_reference = 0;
-    size_t reference_sample_interval = 4096;
-    size_t current_block = 0;
+    if (streaming)
+    {
+        throw std::exception{};
+    }
+    if (channels_count > 1)
+    {
+        encode_channels();
+        return;
+    }
+    if (threads_count != 1)
+    {
+        encode_data_parallel();
+        return;
+    }
+    current_block = 0;
     sample_count = 0;
+    segments.clear();
+    data_offset_bits = 0;
+    output.clear();
+    output.reserve(input_size * 8);
+    zero_blocks_count = 0;
+    statistics = {};
+
+    encode_blocks(input, input_size);
+    flush_zero_blocks();
+
+    this->was_encoded = true;
+}
+
+void encoding_machine::set_threads_count(unsigned int threads_count)
+{
+    this->threads_count = threads_count;
+    pool.reset();
+    if (threads_count > 1)
+    {
+        pool = std::make_unique<thread_pool>(threads_count);
+    }
+    was_encoded = false;
+}
+
+void encoding_machine::set_write_index(bool write_index)
+{
+    this->write_index = write_index;
+}
+
+static uint64_t swap_bytes(uint64_t value)
+{
+#if defined(_MSC_VER)
+    return _byteswap_uint64(value);
+#else
+    return __builtin_bswap64(value);
+#endif
+}
+
+// 8 bytes as a big-endian word and back
+static uint64_t load_word(const BYTE* data)
+{
+    uint64_t value;
+    std::memcpy(&value, data, sizeof(value));
+    return std::endian::native == std::endian::little ? swap_bytes(value) : value;
+}
+
+static void store_word(BYTE* dest, uint64_t value)
+{
+    value = std::endian::native == std::endian::little ? swap_bytes(value) : value;
+    std::memcpy(dest, &value, sizeof(value));
+}
 
-    while(true)
-    //for (const auto& block : get_blocks())
+// Byte i of a segment's output that lands shift bits into a byte of the
+// joined output
+static BYTE get_shifted_byte(const BYTE* source, size_t source_size, size_t i, unsigned int shift)
+{
+    unsigned int value = i < source_size ? source[i] >> shift : 0;
+    if (shift != 0 && i > 0)
     {
-        const auto& block = get_next_block();
-        if (block.size() == 0)
+        value |= source[i - 1] << (8 - shift);
+    }
+    return static_cast<BYTE>(value);
+}
+
+// Every segment of reference_interval blocks starts with a reference block, in
+// the adaptive mode too, and zero block runs never cross it, so segments are
+// encoded apart and their bit streams are joined into the same output as a
+// serial encode. Every segment is shifted into its final place on the pool
+// too, only the bytes that neighbouring segments share are merged after.
+void encoding_machine::encode_data_parallel()
+{
+    size_t segment_bytes = reference_interval * get_block_bytes_count();
+    size_t segments_count = (input_size + segment_bytes - 1) / segment_bytes;
+    std::vector<std::unique_ptr<encoding_machine>> segment_machines(segments_count);
+    std::vector<size_t> segment_bits(segments_count);
+
+    thread_pool& segments_pool = pool ? *pool : thread_pool::get_shared();
+    segments_pool.run(segments_count, [&](size_t i) {
+        auto segment = std::make_unique<encoding_machine>(sample_resolution, block_size, selection, reference_interval, reference, predictor);
+        size_t first_byte = i * segment_bytes;
+        segment->encode_segment(input + first_byte, get_min(segment_bytes, input_size - first_byte), i * reference_interval);
+        segment_bits[i] = segment->output.get_bits_count();
+        segment->output.pad_to_byte();
+        segment_machines[i] = std::move(segment);
+    });
+
+    // first bit of every segment, then the end of the last one
+    std::vector<size_t> segment_offsets(segments_count + 1, 0);
+    sample_count = 0;
+    segments.clear();
+    data_offset_bits = 0;
+    statistics = {};
+    for (size_t i = 0; i < segments_count; ++i)
+    {
+        const encoding_machine& segment = *segment_machines[i];
+        add_coding_statistics(statistics, segment.statistics);
+        for (auto entry : segment.segments)
         {
-            break;
+            entry.bit_offset += segment_offsets[i];
+            segments.push_back(entry);
         }
-        bool reference = current_block++ % reference_sample_interval == 0;
-        uint32_t reference_sample = preprocessor->get_reference();
-        auto [encoded_block, encoded_block_size] = encode_block(block, reference);
-        if (encoded_block_size == 0)
+        sample_count += segment.sample_count;
+        segment_offsets[i + 1] = segment_offsets[i] + segment_bits[i];
+    }
+    size_t bits_count = segment_offsets[segments_count];
+    output.clear();
+    BYTE* dest = output.get_span(bits_count);
+
+    // writes bytes [first, end) of the joined output from segment i, merged
+    // into what is there for the bytes it shares with its neighbours
+    auto shift_segment = [&](size_t i, size_t first, size_t end, bool merge) {
+        const bit_writer& source = segment_machines[i]->output;
+        size_t first_byte = segment_offsets[i] / 8;
+        unsigned int shift = segment_offsets[i] % 8;
+        for (size_t j = first; j < end; ++j)
         {
-            if (zero_blocks_count == 0)
-            {
-                zero_block_needs_ref = reference;
-                if (reference)
-                {
-                    zero_block_reference = reference_sample;
-                }
-            }
-            zero_blocks_count += 1;
-            if (zero_blocks_count == 63 || (reference && zero_blocks_count > 1))
-            {
-                auto [encoded_zero_block, encoded_zero_block_size] = encode_zero_blocks(zero_blocks_count, zero_block_needs_ref, zero_block_reference);
-                for (int i = 0; i < encoded_zero_block_size; ++i)
-                {
-                    set_bit(result, bit_i++, get_bit(encoded_zero_block, i));
-                }
-                zero_blocks_count = 0;
-                zero_block_needs_ref = false;
-            }
-            continue;
+            BYTE value = get_shifted_byte(source.get_ready_bytes(), source.get_ready_bytes_count(), j - first_byte, shift);
+            dest[j] = merge ? dest[j] | value : value;
         }
-        if (zero_blocks_count != 0)
+    };
+    segments_pool.run(segments_count, [&](size_t i) {
+        size_t first = (segment_offsets[i] + 7) / 8;
+        size_t end = segment_offsets[i + 1] / 8;
+        const BYTE* source = segment_machines[i]->output.get_ready_bytes();
+        unsigned int shift = segment_offsets[i] % 8;
+        if (shift == 0 && first < end)
         {
-            auto [encoded_zero_block, encoded_zero_block_size] = encode_zero_blocks(zero_blocks_count, zero_block_needs_ref, zero_block_reference);
-            for (int i = 0; i < encoded_zero_block_size; ++i)
-            {
-                set_bit(result, bit_i++, get_bit(encoded_zero_block, i));
-            }
-            zero_blocks_count = 0;
-            zero_block_needs_ref = false;
+            std::copy(source, source + (end - first), dest + first);
+            return;
+        }
+        // eight bytes at a time, from the source byte before on
+        size_t source_i = first - segment_offsets[i] / 8;
+        for (; first + 8 <= end; first += 8, source_i += 8)
+        {
+            store_word(dest + first, (uint64_t{ source[source_i - 1] } << (64 - shift)) | (load_word(source + source_i) >> shift));
         }
-        for (int i = 0; i < encoded_block_size; ++i)
+        shift_segment(i, first, end, false);
+    });
+    // the bytes segments share hold the bits of all of them
+    for (size_t i = 0; i <= segments_count; ++i)
+    {
+        if (segment_offsets[i] % 8 != 0)
         {
-            set_bit(result, bit_i++, get_bit(encoded_block, i));
+            dest[segment_offsets[i] / 8] = 0;
         }
     }
-    if (zero_blocks_count != 0)
+    for (size_t i = 0; i < segments_count; ++i)
+    {
+        size_t first = (segment_offsets[i] + 7) / 8;
+        size_t end = segment_offsets[i + 1] / 8;
+        size_t end_byte = (segment_offsets[i + 1] + 7) / 8;
+        shift_segment(i, segment_offsets[i] / 8, get_min(first, end_byte), true);
+        shift_segment(i, first > end ? first : end, end_byte, true);
+    }
+    segment_machines.clear();
+    output.commit_span(bits_count);
+    was_encoded = true;
+}
+
+// Every channel is split out of the input and encoded as a complete stream of
+// its own, so it keeps its own predictor state, then the streams are joined
+// behind the channel table. The input holds the same count of samples for
+// every channel, only the zero padding of its last byte may follow them.
+// Nonzero bits past the samples would be cut, so they are rejected.
+void encoding_machine::encode_channels()
+{
+    size_t channel_samples_count = input_size * 8 / sample_resolution / channels_count;
+    size_t samples_count = channel_samples_count * channels_count;
+    if ((samples_count * sample_resolution + 7) / 8 != input_size)
+    {
+        throw std::exception{};
+    }
+    unsigned int used_bits = samples_count * sample_resolution % 8;
+    if (used_bits != 0 && (input[input_size - 1] & (0xFF >> used_bits)) != 0)
+    {
+        throw std::exception{};
+    }
+    std::vector<std::vector<BYTE>> channels(channels_count);
+    std::vector<BYTE*> channel_data(channels_count);
+    for (size_t i = 0; i < channels_count; ++i)
+    {
+        channels[i].resize((channel_samples_count * sample_resolution + 7) / 8);
+        channel_data[i] = channels[i].data();
+    }
+    split_channels(input, input_size, sample_resolution, layout, channels_count, channel_samples_count, channel_data.data());
+
+    std::vector<std::vector<BYTE>> streams(channels_count);
+    std::vector<coding_statistics> channel_statistics(channels_count);
+    auto encode_channel = [&](size_t i) {
+        encoding_machine channel{ sample_resolution, block_size, selection, reference_interval, reference, predictor };
+        channel.set_write_index(write_index);
+        channel.feed_data(std::move(channels[i]));
+        streams[i].resize(channel.get_encoded_size());
+        channel.write_encoded(streams[i].data(), streams[i].size());
+        channel_statistics[i] = channel.statistics;
+    };
+    if (threads_count == 1)
     {
-        auto [encoded_zero_block, encoded_zero_block_size] = encode_zero_blocks(zero_blocks_count, zero_block_needs_ref, zero_block_reference);
-        for (int i = 0; i < encoded_zero_block_size; ++i)
+        for (size_t i = 0; i < channels_count; ++i)
         {
-            set_bit(result, bit_i++, get_bit(encoded_zero_block, i));
+            encode_channel(i);
         }
-        zero_blocks_count = 0;
-        zero_block_needs_ref = false;
+    }
+    else
+    {
+        thread_pool& channels_pool = pool ? *pool : thread_pool::get_shared();
+        channels_pool.run(channels_count, encode_channel);
     }
 
-    this->encoded_data = result;
-    this->encoded_data_length = bit_i;
+    std::vector<size_t> stream_sizes(channels_count);
+    size_t bits_count = 0;
+    for (size_t i = 0; i < channels_count; ++i)
+    {
+        stream_sizes[i] = streams[i].size();
+        bits_count += stream_sizes[i] * 8;
+    }
+    auto table = write_channel_table(layout, stream_sizes);
+    statistics = {};
+    for (const auto& part : channel_statistics)
+    {
+        add_coding_statistics(statistics, part);
+    }
+    sample_count = samples_count;
+    segments.clear();
+    data_offset_bits = 0;
+    output.clear();
+    output.reserve(table.size() * 8 + bits_count);
+    output.append(table, table.size() * 8);
+    for (auto& stream : streams)
+    {
+        output.append(stream, stream.size() * 8);
+        stream = std::vector<BYTE>{};
+    }
+    was_encoded = true;
+}
 
-    this->was_encoded = true;
+void encoding_machine::encode_segment(const BYTE* data, size_t data_size, size_t first_block)
+{
+    current_block = first_block;
+    sample_count = 0;
+    segments.clear();
+    data_offset_bits = 0;
+    output.clear();
+    output.reserve(data_size * 8);
+    zero_blocks_count = 0;
+    statistics = {};
+
+    encode_blocks(data, data_size);
+    flush_zero_blocks();
+}
+
+void encoding_machine::encode_blocks(const BYTE* data, size_t data_size)
+{
+    input = data;
+    input_size = data_size;
+    input_position = 0;
+    while (get_next_block(block.data()))
+    {
+        bool reference = is_reference_block();
+        ++current_block;
+        encode_block(block.data(), reference);
+    }
+}
+
+bool encoding_machine::is_reference_block() const
+{
+    if (current_block % reference_interval == 0)
+    {
+        return true;
+    }
+    // segments of volatile data end early, the decoder finds their references
+    // in the seek index
+    return reference == reference_adaptive && output.get_bits_count() - data_offset_bits - segments.back().bit_offset >= adaptive_segment_bits;
+}
+
+// the channel streams of multichannel data carry their own indexes
+bool encoding_machine::has_index() const
+{
+    return channels_count == 1 && (write_index || reference == reference_adaptive);
+}
+
+size_t encoding_machine::get_block_bytes_count() const
+{
+    return sample_resolution * block_size / 8;
+}
+
+// Early references are only listed in the seek-index trailer, which a streaming
+// decoder reads last, so adaptive references are rejected like channels are.
+void encoding_machine::start_stream()
+{
+    if (channels_count > 1 || reference == reference_adaptive)
+    {
+        throw std::exception{};
+    }
+    source_file.close();
+    source_data.clear();
+    input = nullptr;
+    input_size = 0;
+    stream_input.clear();
+    current_block = 0;
+    sample_count = 0;
+    segments.clear();
+    output.clear();
+    output.reserve(get_block_bytes_count() * 8 * 4);
+    zero_blocks_count = 0;
+    statistics = {};
+
+    BYTE header[encoded_header_size];
+    get_header(header);
+    for (BYTE header_byte : header)
+    {
+        output.write_bits(header_byte, 8);
+    }
+    data_offset_bits = output.get_bits_count();
+    streaming = true;
+    was_encoded = true;
+}
+
+size_t encoding_machine::push_data(const BYTE* data, size_t data_size)
+{
+    if (!streaming)
+    {
+        throw std::exception{};
+    }
+    size_t block_bytes = get_block_bytes_count();
+    if (!stream_input.empty())
+    {
+        size_t missing = get_min(block_bytes - stream_input.size(), data_size);
+        stream_input.insert(stream_input.end(), data, data + missing);
+        data += missing;
+        data_size -= missing;
+        if (stream_input.size() < block_bytes)
+        {
+            return output.get_ready_bytes_count();
+        }
+        encode_blocks(stream_input.data(), block_bytes);
+        stream_input.clear();
+    }
+
+    // whole blocks are encoded straight from the caller's buffer
+    size_t whole_bytes = data_size - data_size % block_bytes;
+    encode_blocks(data, whole_bytes);
+    stream_input.assign(data + whole_bytes, data + data_size);
+    input = nullptr;
+    input_size = 0;
+    return output.get_ready_bytes_count();
+}
+
+size_t encoding_machine::finish_stream()
+{
+    if (!streaming)
+    {
+        throw std::exception{};
+    }
+    encode_blocks(stream_input.data(), stream_input.size());
+    stream_input.clear();
+    input = nullptr;
+    input_size = 0;
+    flush_zero_blocks();
+    output.pad_to_byte();
+    if (has_index())
+    {
+        for (BYTE trailer_byte : write_seek_index(segments))
+        {
+            output.write_bits(trailer_byte, 8);
+        }
+    }
+    streaming = false;
+    return output.get_ready_bytes_count();
+}
+
+size_t encoding_machine::read_stream_bytes(BYTE* dest, size_t count)
+{
+    return output.take_bytes(dest, count);
 }
 
 void encoding_machine::save_to_file(const std::string& filename)
@@ -218,459 +533,407 @@ void encoding_machine::save_to_file(const std::string& filename)
     }
 
     std::ofstream file{ filename, std::ofstream::out | std::ofstream::binary };
-    save_header(file);
-    for (BYTE byte : encoded_data)
+    BYTE header[encoded_header_size];
+    get_header(header);
+    file.write((const char*)header, encoded_header_size);
+    auto encoded_data = output.get_data();
+    file.write((const char*)encoded_data.data(), encoded_data.size());
+    if (has_index())
     {
-        file.write((const char*)(&byte), 1);
+        auto trailer = write_seek_index(segments);
+        file.write((const char*)trailer.data(), trailer.size());
     }
     file.close();
 }
 
-std::vector<BYTE> encoding_machine::get_encoded_data()
+size_t encoding_machine::get_encoded_size()
 {
     if (!was_encoded)
     {
         this->encode_data();
     }
-    return this->encoded_data;
+    size_t size = encoded_header_size + (output.get_bits_count() + 7) / 8;
+    if (has_index())
+    {
+        size += segments.size() * seek_index_entry_size + 8;
+    }
+    return size;
 }
 
-size_t encoding_machine::get_encoded_bits_count()
+size_t encoding_machine::write_encoded(BYTE* dest, size_t dest_size)
 {
-    if (!was_encoded)
+    size_t size = get_encoded_size();
+    if (dest_size < size)
     {
-        this->encode_data();
+        throw std::exception{};
+    }
+    get_header(dest);
+    output.copy_data(dest + encoded_header_size);
+    if (has_index())
+    {
+        auto trailer = write_seek_index(segments);
+        std::copy(trailer.begin(), trailer.end(), dest + size - trailer.size());
     }
-    return this->encoded_data_length;
+    return size;
 }
 
-std::vector<std::vector<uint32_t>> encoding_machine::get_blocks()
+size_t encoding_machine::encode_into(BYTE* dest, size_t dest_size)
 {
-    size_t bit_i = 0;
-    size_t sample_i = 0;
-    uint32_t sample = 0;
-    std::vector<std::vector<uint32_t>> blocks;
-    bool sample_completed = false;
-    for (size_t i = 0; i < this->source_data.size(); ++i)
+    if (dest_size < encoded_header_size)
     {
-        for (size_t j = 0; j < 8; ++j)
-        {
-            sample <<= 1;
-            if (get_bit(this->source_data, bit_i++))
-            {
-                sample |= 1;
-            }
-            if (bit_i % sample_resolution == 0)
-            {
-                if (sample_i % block_size == 0)
-                {
-                    blocks.push_back(std::vector<uint32_t>{});
-                    blocks[sample_i / block_size].resize(block_size);
-                }
-                blocks[sample_i / block_size][sample_i % block_size] = sample;
-                if (sample_i == 0)
-                {
-                    preprocessor->get_preprocessed(sample);
-                }
-                ++sample_i;
-                sample = 0;
-                sample_completed = true;
-            }
-            else
-            {
-                sample_completed = false;
-            }
-        }
+        throw std::exception{};
     }
-    while (!sample_completed)
+    size_t size = 0;
+    output.attach(dest + encoded_header_size, dest_size - encoded_header_size);
+    try
     {
-        sample <<= 1;
-        ++bit_i;
-        if (bit_i % sample_resolution == 0)
+        encode_data();
+        output.pad_to_byte();
+        size = encoded_header_size + output.get_ready_bytes_count();
+        if (has_index())
         {
-            if (sample_i % block_size)
+            auto trailer = write_seek_index(segments);
+            if (size + trailer.size() > dest_size)
             {
-                blocks.push_back(std::vector<uint32_t>{});
-                blocks[sample_i / block_size].resize(block_size);
+                throw std::exception{};
             }
-            blocks[sample_i / block_size][sample_i % block_size] = sample;
-            ++sample_i;
-            sample_completed = true;
+            std::copy(trailer.begin(), trailer.end(), dest + size);
+            size += trailer.size();
         }
+        get_header(dest);
+    }
+    catch (...)
+    {
+        output.detach();
+        was_encoded = false;
+        throw;
     }
-    sample_count = sample_i;
+    output.detach();
+    was_encoded = false;
+    return size;
+}
 
-    return blocks;
+size_t encoding_machine::get_max_encoded_size(size_t data_size) const
+{
+    if (channels_count == 1)
+    {
+        return get_stream_max_size(data_size);
+    }
+    size_t channel_samples_count = data_size * 8 / sample_resolution / channels_count;
+    size_t channel_size = (channel_samples_count * sample_resolution + 7) / 8;
+    return encoded_header_size + channel_table_header_size + channels_count * (channel_table_entry_size + get_stream_max_size(channel_size));
 }
 
-std::pair<std::vector<BYTE>, size_t> encoding_machine::encode_block(const std::vector<uint32_t>& block, bool reference)
+size_t encoding_machine::get_stream_max_size(size_t data_size) const
 {
-    if (block.size() != block_size)
+    size_t samples_count = (data_size * 8 + sample_resolution - 1) / sample_resolution;
+    size_t blocks_count = (samples_count + block_size - 1) / block_size;
+    // no option is chosen over an uncompressed block and a zero block run is
+    // never longer than the same blocks uncompressed
+    size_t block_bits = no_compression_prefix_size + sample_resolution + size_t{ block_size } * sample_resolution;
+    size_t size = encoded_header_size + (blocks_count * block_bits + 7) / 8;
+    if (write_index || reference == reference_adaptive)
+    {
+        size_t segments_count = reference == reference_adaptive ? blocks_count : blocks_count / reference_interval + 1;
+        size += segments_count * seek_index_entry_size + 8;
+    }
+    return size;
+}
+
+size_t encoding_machine::get_encoded_data(BYTE* dest, size_t dest_size)
+{
+    size_t size = (get_encoded_bits_count() + 7) / 8;
+    if (dest_size < size)
     {
         throw std::exception{};
     }
+    output.copy_data(dest);
+    return size;
+}
 
-    uint32_t reference_value = 0;// = preprocessor->get_reference();
-    if (reference)
+std::vector<BYTE> encoding_machine::get_encoded_data()
+{
+    if (!was_encoded)
     {
-        preprocessor->get_preprocessed(block[0]);
-        reference_value = preprocessor->get_reference();
+        this->encode_data();
     }
+    return output.get_data();
+}
 
-    std::vector<uint32_t> preprocessed_block{};
-    for (const auto sample : block)
+size_t encoding_machine::get_encoded_bits_count()
+{
+    if (!was_encoded)
     {
-        preprocessed_block.push_back(preprocessor->get_preprocessed(sample));
+        this->encode_data();
     }
+    return output.get_bits_count();
+}
 
-    size_t se_size = get_second_extension_size(preprocessed_block, reference);
-    size_t no_compression_size = sample_resolution * block_size + no_compression_prefix_size;
-
-    std::vector<size_t> k_sizes;
-    k_sizes.resize(max_k + 1);
-    for (unsigned int i = 0; i <= max_k; ++i)
+void encoding_machine::encode_block(const uint32_t* block, bool reference)
+{
+    uint32_t reference_value = 0;
+    if (reference)
     {
-        k_sizes[i] = no_compression_prefix_size;
+        sample_preprocessor->reset(block[0]);
+        reference_value = block[0];
     }
 
-    bool all_zero = true;
-    for (const auto sample : preprocessed_block)
+    sample_preprocessor->preprocess(block, preprocessed_block.data(), block_size);
+
+    size_t no_compression_size = sample_resolution * block_size + no_compression_prefix_size;
+    block_costs costs;
+    if (selection == selection_fast)
+    {
+        estimate_block_costs(block_costs_kernels, preprocessed_block.data(), block_size, max_k, no_compression_prefix_size, reference, no_compression_size, costs);
+    }
+    else
+    {
+        compute_block_costs(block_costs_kernels, preprocessed_block.data(), block_size, max_k, no_compression_prefix_size, reference, costs);
+    }
+    // a zero block run never continues across a reference block
+    if (reference)
+    {
+        flush_zero_blocks();
+        segments.push_back({ output.get_bits_count() - data_offset_bits, (current_block - 1) * block_size });
+    }
+    if (costs.all_zero)
     {
-        if (sample != 0)
+        if (zero_blocks_count == 0)
         {
-            all_zero = false;
+            zero_block_needs_ref = reference;
+            zero_block_reference = reference_value;
         }
-        for (uint64_t j = 0; j <= max_k; ++j)
+        zero_blocks_count += 1;
+        if (zero_blocks_count == 63)
         {
-            k_sizes[j] += j + ((sample >> j) + 1);
+            flush_zero_blocks();
         }
+        return;
     }
-    if (all_zero)
-    {
-        std::pair<std::vector<BYTE>, size_t> result{};
-        result.second = 0;
-        return result;
-    }
+    flush_zero_blocks();
+
+    size_t se_size = costs.second_extension_size;
 
     size_t min_size = no_compression_size;
     int min_size_k = -1;
     for (unsigned int i = 0; i <= max_k; ++i)
     {
-        if (k_sizes[i] < min_size)
+        if (costs.k_sizes[i] < min_size)
         {
-            min_size = k_sizes[i];
+            min_size = costs.k_sizes[i];
             min_size_k = i;
         }
     }
 
+    size_t first_bit = output.get_bits_count();
+    unsigned int option;
     if (min_size > se_size)
     {
-        return encode_second_extension(preprocessed_block, reference, reference_value);
+        encode_second_extension(preprocessed_block.data(), reference, reference_value);
+        option = option_second_extension;
     }
-    if (min_size_k == -1)
+    else if (min_size_k == -1)
     {
-        return encode_no_compression(preprocessed_block, reference, reference_value);
+        encode_no_compression(preprocessed_block.data(), reference, reference_value);
+        option = option_no_compression;
     }
-    if (min_size_k == 0)
+    else if (min_size_k == 0)
     {
-        return encode_fundamental_sequence(preprocessed_block, reference, reference_value);
-    }
-    return encode_split_sample(preprocessed_block, reference, reference_value, min_size_k);
-}
-
-std::vector<uint32_t> encoding_machine::get_next_block()
-{
-    std::vector<uint32_t> next_block;
-    BYTE in_buf[64 * 32];
-
-    std::vector<BYTE> in_data;
-
-    in_file.read((char*)in_buf, sample_resolution * block_size / 8);
-    if (in_file)
-    {
-        for (int i = 0; i < sample_resolution * block_size / 8; ++i)
-        {
-            in_data.push_back(in_buf[i]);
-        }
+        encode_fundamental_sequence(preprocessed_block.data(), reference, reference_value);
+        option = option_fundamental_sequence;
     }
     else
     {
-        for (int i = 0; i < in_file.gcount(); ++i)
-        {
-            in_data.push_back(in_buf[i]);
-        }
+        encode_split_sample(preprocessed_block.data(), reference, reference_value, min_size_k);
+        option = option_split_sample + min_size_k - 1;
     }
+    count_blocks(option, 1, first_bit, reference);
+}
 
-    if (in_data.size() == 0)
+bool encoding_machine::get_next_block(uint32_t* next_block)
+{
+    size_t in_data_size = get_min<size_t>(get_block_bytes_count(), input_size - input_position);
+    if (in_data_size == 0)
     {
-        return next_block;
+        return false;
     }
+    const BYTE* in_data = input + input_position;
+    input_position += in_data_size;
 
-
-    size_t bits_count = in_data.size() * 8;
-    size_t current_i = 0;
-    size_t actual_count = 0;
-
-    for (int i = 0; i < block_size; ++i)
-    {
-        uint32_t sample = 0;
-        for (int j = 0; j < sample_resolution; ++j)
-        {
-            if (current_i >= bits_count)
-            {
-                for (int k = j; k < sample_resolution; ++k)
-                {
-                    sample <<= 1;
-                }
-                break;
-            }
-            sample <<= 1;
-            if (get_bit(in_data, current_i++))
-            {
-                sample |= 1;
-            }
-        }
-        next_block.push_back(sample);
-        ++actual_count;
-        if (current_i >= bits_count)
-        {
-            for (i = i + 1; i < block_size; ++i)
-            {
-                next_block.push_back(0);
-            }
-        }
-    }
-    sample_count += actual_count;
-    return next_block;
+    sample_count += unpack_samples(in_data, in_data_size, sample_resolution, next_block, block_size);
+    return true;
 }
 
-std::pair<std::vector<BYTE>, size_t> encoding_machine::encode_no_compression(const std::vector<uint32_t>& block, bool reference, uint32_t reference_value)
+void encoding_machine::encode_no_compression(const uint32_t* block, bool reference, uint32_t reference_value)
 {
-    std::pair<std::vector<BYTE>, size_t> result{};
-
-    for (int i = 0; i < no_compression_prefix_size; ++i)
-    {
-        set_bit(result.first, i, true);
-    }
-    //for (size_t i = 1; i <= no_compression_prefix_size; ++i) // store prefix
-    //{
-    //    bool val = (no_compression_prefix >> (no_compression_prefix_size - i)) & 1;
-    //    set_bit(result.first, i - 1, val);
-    //}
-
-    size_t i = no_compression_prefix_size;
+    output.write_bits(no_compression_prefix, no_compression_prefix_size);
     if (reference) // store reference value
     {
-        for (size_t j = 1; j <= sample_resolution; ++j)
-        {
-            bool val = (reference_value >> (sample_resolution - j)) & 1;
-            set_bit(result.first, i++, val);
-        }
+        output.write_bits(reference_value, sample_resolution);
     }
 
-    int k = 0;
+    size_t k = 0;
     if (reference)
     {
         k = 1;
     }
-    for (k; k < block.size(); ++k)
+    for (; k < block_size; ++k)
     {
-        uint32_t sample = block[k];
-        for (int j = 1; j <= sample_resolution; ++j)
-        {
-            bool val = (sample >> (sample_resolution - j)) & 1;
-            set_bit(result.first, i++, val);
-        }
+        output.write_bits(block[k], sample_resolution);
     }
-
-    result.second = i;
-    return result;
 }
 
-std::pair<std::vector<BYTE>, size_t> encoding_machine::encode_second_extension(const std::vector<uint32_t>& block, bool reference, uint32_t reference_value)
+void encoding_machine::encode_second_extension(const uint32_t* block, bool reference, uint32_t reference_value)
 {
-    std::pair<std::vector<BYTE>, size_t> result{};
-    size_t prefix = 1;
-    for (int i = 0; i < no_compression_prefix_size; ++i)
-    {
-        set_bit(result.first, i, false);
-    }
-    set_bit(result.first, no_compression_prefix_size, true);
-
-
-    size_t i = no_compression_prefix_size + 1;
+    output.write_bits(1, no_compression_prefix_size + 1);
     if (reference) // store reference value
     {
-        for (size_t j = 1; j <= sample_resolution; ++j)
-        {
-            bool val = (reference_value >> (sample_resolution - j)) & 1;
-            set_bit(result.first, i++, val);
-        }
+        output.write_bits(reference_value, sample_resolution);
     }
 
-    for (const auto& sample : get_second_extension_block(block, reference))
+    for (size_t i = 0; i < block_size; i += 2)
     {
-        for (int j = 0; j < sample; ++j)
+        uint64_t sample_a = block[i];
+        if (reference && i == 0)
         {
-            set_bit(result.first, i++, false);
+            sample_a = 0;
         }
-        set_bit(result.first, i++, true);
+        uint64_t sample_b = block[i + 1];
+        output.write_unary((sample_a + sample_b) * (sample_a + sample_b + 1) / 2 + sample_b);
     }
-
-    result.second = i;
-    return result;
 }
 
-std::pair<std::vector<BYTE>, size_t> encoding_machine::encode_fundamental_sequence(const std::vector<uint32_t>& block, bool reference, uint32_t reference_value)
+void encoding_machine::encode_fundamental_sequence(const uint32_t* block, bool reference, uint32_t reference_value)
 {
-    std::pair<std::vector<BYTE>, size_t> result{};
-    size_t prefix = 1;
-    for (int i = 1; i < no_compression_prefix_size; ++i)
-    {
-        set_bit(result.first, i - 1, false);
-    }
-    set_bit(result.first, no_compression_prefix_size - 1, true);
-
-
-    size_t i = no_compression_prefix_size;
+    output.write_bits(1, no_compression_prefix_size);
     if (reference) // store reference value
     {
-        for (size_t j = 1; j <= sample_resolution; ++j)
-        {
-            bool val = (reference_value >> (sample_resolution - j)) & 1;
-            set_bit(result.first, i++, val);
-        }
+        output.write_bits(reference_value, sample_resolution);
     }
 
-    int k = 0;
+    size_t k = 0;
     if (reference)
     {
         k = 1;
     }
-    for (k; k < block.size(); ++k)
+    for (; k < block_size; ++k)
     {
-        uint32_t sample = block[k];
-        for (int j = 0; j < sample; ++j)
-        {
-            set_bit(result.first, i++, false);
-        }
-        set_bit(result.first, i++, true);
+        output.write_unary(block[k]);
     }
-    result.second = i;
-    return result;
 }
 
-std::pair<std::vector<BYTE>, size_t> encoding_machine::encode_split_sample(const std::vector<uint32_t>& block, bool reference, uint32_t reference_value, size_t k)
+void encoding_machine::encode_split_sample(const uint32_t* block, bool reference, uint32_t reference_value, size_t k)
 {
-    std::pair<std::vector<BYTE>, size_t> result{};
-    size_t prefix = k + 1;
-    for (size_t i = 1; i <= no_compression_prefix_size; ++i) // store prefix
-    {
-        bool val = (prefix >> (no_compression_prefix_size - i)) & 1;
-        set_bit(result.first, i - 1, val);
-    }
-
-    size_t i = no_compression_prefix_size;
+    output.write_bits(k + 1, no_compression_prefix_size);
     if (reference) // store reference value
     {
-        for (size_t j = 1; j <= sample_resolution; ++j)
-        {
-            bool val = (reference_value >> (sample_resolution - j)) & 1;
-            set_bit(result.first, i++, val);
-        }
+        output.write_bits(reference_value, sample_resolution);
     }
 
-    int k1 = 0;
+    size_t first = 0;
     if (reference)
     {
-        k1 = 1;
+        first = 1;
     }
-    for (k1; k1 < block.size(); ++k1)
+    for (size_t k1 = first; k1 < block_size; ++k1)
     {
-        uint32_t sample = block[k1];
-        size_t fs_size = sample >> k;
-        for (int j = 0; j < fs_size; ++j)
-        {
-            set_bit(result.first, i++, false);
-        }
-        set_bit(result.first, i++, true);
+        output.write_unary(block[k1] >> k);
+    }
+    for (size_t k1 = first; k1 < block_size; ++k1)
+    {
+        output.write_bits(block[k1], static_cast<unsigned int>(k));
     }
+}
 
-    uint32_t mask = 0xFFFFFFFFu >> (32 - k);
-    k1 = 0;
+void encoding_machine::encode_zero_blocks(size_t zero_block_count, bool reference, uint32_t reference_value)
+{
+    size_t first_bit = output.get_bits_count();
+    output.write_zeros(no_compression_prefix_size + 1);
     if (reference)
     {
-        k1 = 1;
+        output.write_bits(reference_value, sample_resolution);
     }
-    for (k1; k1 < block.size(); ++k1)
+    size_t trailing_zeroes_count = zero_block_count;
+    if (zero_block_count < 5)
     {
-        uint32_t sample = block[k1];
-        uint32_t split_bits = sample & mask;
-        for (int j = 1; j <= k; ++j)
-        {
-            bool val = (split_bits >> (k - j)) & 1;
-            set_bit(result.first, i++, val);
-        }
+        trailing_zeroes_count -= 1;
     }
-    result.second = i;
-    return result;
+    output.write_unary(trailing_zeroes_count);
+    count_blocks(option_zero_block, zero_block_count, first_bit, reference);
 }
 
-std::pair<std::vector<BYTE>, size_t> encoding_machine::encode_zero_blocks(size_t zero_block_count, bool reference, uint32_t reference_value)
+void encoding_machine::count_blocks(unsigned int option, size_t blocks_count, size_t first_bit, bool reference)
 {
-    std::pair<std::vector<BYTE>, size_t> result{};
-    size_t i = 0;
-    for (int j = 0; j < no_compression_prefix_size + 1; ++j)
+    size_t bits_count = output.get_bits_count() - first_bit;
+    if (reference)
     {
-        set_bit(result.first, i++, false);
+        statistics.reference_blocks += 1;
+        statistics.reference_bits += sample_resolution;
+        bits_count -= sample_resolution;
     }
-    if (reference)
+    statistics.blocks[option] += blocks_count;
+    statistics.bits[option] += bits_count;
+}
+
+const coding_statistics& encoding_machine::get_statistics() const
+{
+    return statistics;
+}
+
+bool encoding_machine::is_second_extension_best() const
+{
+    for (unsigned int i = 0; i < coding_options_count; ++i)
     {
-        for (int j = 1; j <= sample_resolution; ++j)
+        if (i != option_second_extension && statistics.blocks[i] >= statistics.blocks[option_second_extension])
         {
-            bool value = (reference_value >> (sample_resolution - j)) & 1;
-            set_bit(result.first, i++, value);
+            return false;
         }
     }
-    size_t trailing_zeroes_count = zero_block_count;
-    if (zero_block_count < 5)
-    {
-        trailing_zeroes_count -= 1;
-    }
-    for (int j = 0; j < trailing_zeroes_count; ++j)
+    return true;
+}
+
+void encoding_machine::flush_zero_blocks()
+{
+    if (zero_blocks_count == 0)
     {
-        set_bit(result.first, i++, false);
+        return;
     }
-    set_bit(result.first, i++, true);
-    result.second = i;
-    return result;
+    encode_zero_blocks(zero_blocks_count, zero_block_needs_ref, zero_block_reference);
+    zero_blocks_count = 0;
+    zero_block_needs_ref = false;
 }
 
-void encoding_machine::save_header(std::ofstream& out)
+void encoding_machine::get_header(BYTE* header) const
 {
-    BYTE* header = new BYTE[6];
     header[0] = 0b01110000;
     header[1] = 0b00100000;
     header[2] = (sample_resolution - 1) & 0b11111;
     BYTE line_3;
     if (block_size == 8)
-        line_3 = 0b00011111;
+        line_3 = 0b00010000;
     else if (block_size == 16)
-        line_3 = 0b00111111;
+        line_3 = 0b00110000;
     else if (block_size == 32)
-        line_3 = 0b01011111;
+        line_3 = 0b01010000;
     else
-        line_3 = 0b01111111;
+        line_3 = 0b01110000;
 
-    header[3] = line_3;  // 0[block_size:2]1[reference:4
-    header[4] = 0b11111111;  // sample interval:8]
+    unsigned int interval_field = reference_interval - 1;
+    header[3] = line_3 | (interval_field >> 8);  // 0[block_size:2]1[reference:4
+    header[4] = interval_field & 0xFF;  // sample interval:8]
     header[5] = 0b00000000;
+    if (has_index())
+        header[5] |= header_flag_seek_index;
+    if (reference == reference_adaptive && channels_count == 1)
+        header[5] |= header_flag_adaptive_reference;
+    header[5] |= predictor << header_predictor_shift;
+    if (channels_count > 1)
+        header[5] |= header_flag_multichannel;
     if ((sample_count & 0xFFFFFFFFFFFFull) != sample_count)
     {
         throw std::exception{};
     }
-    out.write((char*)header, 6);
-    BYTE* s_count = new BYTE[6];
+    BYTE* s_count = header + 6;
     for (int i = 0; i < 48; ++i)
     {
         if (i % 8 == 0)
@@ -679,7 +942,4 @@ void encoding_machine::save_header(std::ofstream& out)
         }
         s_count[i / 8] |= ((sample_count >> (47 - i)) & 1) << (7 - (i % 8));
     }
-    out.write((char*)s_count, 6);
-    delete[] header;
-    delete[] s_count;
 }
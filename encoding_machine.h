@@ -10,16 +10,43 @@
 #include <iostream>
 #include <fstream>
 #include "helpers.h"
+#include "bit_writer.h"
+#include "block_costs.h"
+#include "sample_unpacker.h"
+#include "mapped_file.h"
+#include "thread_pool.h"
+#include "seek_index.h"
+#include "channel_layout.h"
 
 class encoding_machine
 {
 private:
     std::vector<BYTE> source_data;
-    std::vector<BYTE> encoded_data;
-    size_t encoded_data_length = 0;
+    mapped_file source_file;
+    const BYTE* input = nullptr;
+    size_t input_size = 0;
+    size_t input_position = 0;
+    bit_writer output;
     size_t sample_count = 0;
+    size_t current_block = 0;
+    // start of every reference sample segment, for the seek index trailer
+    std::vector<seek_index_entry> segments;
+    size_t data_offset_bits = 0;
+    bool write_index = false;
+
+    // input bytes of the block that is not complete yet while streaming
+    std::vector<BYTE> stream_input;
+    bool streaming = false;
+
+    std::array<uint32_t, max_block_size> block;
+    std::array<uint32_t, max_block_size> preprocessed_block;
+
+    size_t zero_blocks_count = 0;
+    bool zero_block_needs_ref = false;
+    uint32_t zero_block_reference = 0;
 
     bool was_encoded = false;
+    coding_statistics statistics{};
     
     unsigned int sample_resolution;
     unsigned int block_size;
@@ -27,30 +54,73 @@ private:
     unsigned int max_k;
     unsigned int no_compression_prefix;
     unsigned int no_compression_prefix_size;
+    unpack_kernel unpack_samples;
+    costs_kernels block_costs_kernels;
+    unsigned int selection;
+    unsigned int reference_interval;
+    unsigned int reference;
+    unsigned int predictor;
+    unsigned int channels_count;
+    unsigned int layout;
+    // encoded bits after which an adaptive segment ends early
+    size_t adaptive_segment_bits;
+    // 1 encodes on the calling thread, 0 uses the shared pool
+    unsigned int threads_count = 1;
+    std::unique_ptr<thread_pool> pool;
 
-    std::unique_ptr<preprocessor> preprocessor;
-
-    std::ifstream in_file;
+    std::unique_ptr<preprocessor> sample_preprocessor;
 public:
-    bool se_better = false;
-    encoding_machine(unsigned int sample_resolution, unsigned int block_size);
+    encoding_machine(unsigned int sample_resolution, unsigned int block_size, unsigned int selection = selection_exact,
+        unsigned int reference_interval = default_reference_interval, unsigned int reference = reference_fixed,
+        unsigned int predictor = predictor_unit_delay, unsigned int channels_count = 1, unsigned int layout = layout_interleaved);
 
-    void feed_data(const std::vector<BYTE>& data);
+    void feed_data(std::vector<BYTE> data);
+    // borrows data, it has to outlive the encoding
+    void feed_data(const BYTE* data, size_t data_size);
     void feed_data_from_file(const std::string& filename);
     void encode_data();
     void save_to_file(const std::string& filename);
     std::vector<BYTE> get_encoded_data();
+    // copies the encoded data without header, returns the bytes count
+    size_t get_encoded_data(BYTE* dest, size_t dest_size);
     size_t get_encoded_bits_count();
+    // header, encoded data and seek index, as save_to_file writes them
+    size_t get_encoded_size();
+    size_t write_encoded(BYTE* dest, size_t dest_size);
+    // encodes straight into dest, header and seek index included
+    size_t encode_into(BYTE* dest, size_t dest_size);
+    // bound of encode_into output for data_size input bytes
+    size_t get_max_encoded_size(size_t data_size) const;
+    void set_threads_count(unsigned int threads_count);
+    void set_write_index(bool write_index);
+
+    // Streaming: the header goes to the output first with a zero sample count,
+    // encoded bytes are taken with read_stream_bytes as blocks complete and the
+    // final header from get_header replaces the first encoded_header_size bytes.
+    void start_stream();
+    size_t push_data(const BYTE* data, size_t data_size);
+    size_t finish_stream();
+    size_t read_stream_bytes(BYTE* dest, size_t count);
+    void get_header(BYTE* header) const;
+    const coding_statistics& get_statistics() const;
+    bool is_second_extension_best() const;
 private:
-    std::vector<uint32_t> get_next_block();
-    std::vector<std::vector<uint32_t>> get_blocks();
-    std::pair<std::vector<BYTE>, size_t> encode_block(const std::vector<uint32_t>& block, bool reference);
-    std::pair<std::vector<BYTE>, size_t> encode_no_compression(const std::vector<uint32_t>& block, bool reference, uint32_t reference_value);
-    std::pair<std::vector<BYTE>, size_t> encode_second_extension(const std::vector<uint32_t>& block, bool reference, uint32_t reference_value);
-    std::pair<std::vector<BYTE>, size_t> encode_fundamental_sequence(const std::vector<uint32_t>& block, bool reference, uint32_t reference_value);
-    std::pair<std::vector<BYTE>, size_t> encode_split_sample(const std::vector<uint32_t>& block, bool reference, uint32_t reference_value, size_t k);
-    std::pair<std::vector<BYTE>, size_t> encode_zero_blocks(size_t zero_block_count, bool reference, uint32_t reference_value);
-    void save_header(std::ofstream& out);
-    size_t get_second_extension_size(const std::vector<uint32_t>& block, bool reference);
-    std::vector<uint64_t> get_second_extension_block(const std::vector<uint32_t>& block, bool reference);
+    size_t get_block_bytes_count() const;
+    void encode_blocks(const BYTE* data, size_t data_size);
+    bool is_reference_block() const;
+    bool has_index() const;
+    void encode_data_parallel();
+    void encode_channels();
+    size_t get_stream_max_size(size_t data_size) const;
+    void encode_segment(const BYTE* data, size_t data_size, size_t first_block);
+    bool get_next_block(uint32_t* next_block);
+    void encode_block(const uint32_t* block, bool reference);
+    void encode_no_compression(const uint32_t* block, bool reference, uint32_t reference_value);
+    void encode_second_extension(const uint32_t* block, bool reference, uint32_t reference_value);
+    void encode_fundamental_sequence(const uint32_t* block, bool reference, uint32_t reference_value);
+    void encode_split_sample(const uint32_t* block, bool reference, uint32_t reference_value, size_t k);
+    void encode_zero_blocks(size_t zero_block_count, bool reference, uint32_t reference_value);
+    void flush_zero_blocks();
+    // counts the bits written since first_bit towards option
+    void count_blocks(unsigned int option, size_t blocks_count, size_t first_bit, bool reference);
 };
@@ -0,0 +1,15 @@
+#pragma once
+
+// DIPLOMA_EXPORTS is defined while the library itself is built, by the project
+// files on Windows and by CMake elsewhere
+#if defined(_WIN32)
+#ifdef DIPLOMA_EXPORTS
+#define ENCODER_API __declspec(dllexport)
+#else
+#define ENCODER_API __declspec(dllimport)
+#endif
+#elif defined(__GNUC__)
+#define ENCODER_API __attribute__((visibility("default")))
+#else
+#define ENCODER_API
+#endif
@@ -0,0 +1,139 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+#include <exception>
+
+// Owns the objects behind API handles. A handle holds a slot index in its low
+// half and the slot generation in the high one, the generation changes when
+// the slot is freed, so stale handles are rejected. Slots live in chunks that
+// are never moved, lookups take no lock; only add and remove lock the free list.
+template<typename T>
+class handle_registry
+{
+private:
+    static constexpr unsigned int index_bits = sizeof(size_t) * 4;
+    static constexpr size_t index_mask = (size_t{ 1 } << index_bits) - 1;
+    static constexpr size_t generation_mask = SIZE_MAX >> index_bits;
+    static constexpr size_t chunk_size = 1024;
+    static constexpr size_t max_chunks = index_mask / chunk_size + 1 < 1024 ? index_mask / chunk_size + 1 : 1024;
+
+    struct slot
+    {
+        std::atomic<uint32_t> generation{ 1 };
+        std::atomic<T*> object{ nullptr };
+    };
+
+    std::array<std::atomic<slot*>, max_chunks> chunks{};
+    size_t slots_count = 0;
+    std::vector<uint32_t> free_slots;
+    std::mutex slots_mutex;
+
+    slot* find_slot(size_t index) const;
+public:
+    handle_registry() = default;
+    handle_registry(const handle_registry&) = delete;
+    handle_registry& operator=(const handle_registry&) = delete;
+    ~handle_registry();
+
+    size_t add(std::unique_ptr<T> object);
+    // throws for handles that were never added or were removed
+    T* get(size_t handle) const;
+    void remove(size_t handle);
+};
+
+template<typename T>
+handle_registry<T>::~handle_registry()
+{
+    for (auto& chunk : chunks)
+    {
+        slot* slots = chunk.load();
+        if (slots == nullptr)
+        {
+            continue;
+        }
+        for (size_t i = 0; i < chunk_size; ++i)
+        {
+            delete slots[i].object.load();
+        }
+        delete[] slots;
+    }
+}
+
+template<typename T>
+typename handle_registry<T>::slot* handle_registry<T>::find_slot(size_t index) const
+{
+    if (index >= chunk_size * max_chunks)
+    {
+        return nullptr;
+    }
+    slot* slots = chunks[index / chunk_size].load(std::memory_order_acquire);
+    return slots == nullptr ? nullptr : slots + index % chunk_size;
+}
+
+template<typename T>
+size_t handle_registry<T>::add(std::unique_ptr<T> object)
+{
+    std::lock_guard<std::mutex> lock{ slots_mutex };
+    size_t index;
+    if (!free_slots.empty())
+    {
+        index = free_slots.back();
+        free_slots.pop_back();
+    }
+    else
+    {
+        if (slots_count == chunk_size * max_chunks)
+        {
+            throw std::exception{};
+        }
+        index = slots_count++;
+        if (index % chunk_size == 0)
+        {
+            chunks[index / chunk_size].store(new slot[chunk_size], std::memory_order_release);
+        }
+    }
+    slot* free_slot = find_slot(index);
+    free_slot->object.store(object.release(), std::memory_order_release);
+    return (size_t{ free_slot->generation.load(std::memory_order_relaxed) } << index_bits) | index;
+}
+
+template<typename T>
+T* handle_registry<T>::get(size_t handle) const
+{
+    slot* handle_slot = find_slot(handle & index_mask);
+    if (handle_slot == nullptr || handle_slot->generation.load(std::memory_order_acquire) != handle >> index_bits)
+    {
+        throw std::exception{};
+    }
+    T* object = handle_slot->object.load(std::memory_order_acquire);
+    if (object == nullptr)
+    {
+        throw std::exception{};
+    }
+    return object;
+}
+
+template<typename T>
+void handle_registry<T>::remove(size_t handle)
+{
+    std::lock_guard<std::mutex> lock{ slots_mutex };
+    slot* handle_slot = find_slot(handle & index_mask);
+    if (handle_slot == nullptr || handle_slot->generation.load(std::memory_order_relaxed) != handle >> index_bits)
+    {
+        throw std::exception{};
+    }
+    T* object = handle_slot->object.exchange(nullptr, std::memory_order_acq_rel);
+    if (object == nullptr)
+    {
+        throw std::exception{};
+    }
+    // generation 0 is skipped so that no handle is ever 0
+    uint32_t generation = (handle_slot->generation.load(std::memory_order_relaxed) + 1) & generation_mask;
+    handle_slot->generation.store(generation == 0 ? 1 : generation, std::memory_order_release);
+    free_slots.push_back(static_cast<uint32_t>(handle & index_mask));
+    delete object;
+}
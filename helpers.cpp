@@ -34,6 +34,11 @@ bool get_bit(const std::vector<BYTE>& source, size_t i)
     return get_bit(source[i / 8], i % 8);
 }
 
+bool get_bit(const BYTE* source, size_t i)
+{
+    return get_bit(source[i / 8], i % 8);
+}
+
 void set_bit(std::vector<BYTE>& dest, size_t i, bool value)
 {
     while (dest.size() <= i / 8)
@@ -42,3 +47,21 @@ void set_bit(std::vector<BYTE>& dest, size_t i, bool value)
     }
     dest[i / 8] = set_bit(dest[i / 8], i % 8, value);
 }
+
+void write_uint64(std::vector<BYTE>& dest, uint64_t value)
+{
+    for (int i = 7; i >= 0; --i)
+    {
+        dest.push_back(static_cast<BYTE>(value >> (i * 8)));
+    }
+}
+
+uint64_t read_uint64(const BYTE* source)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < 8; ++i)
+    {
+        value = (value << 8) | source[i];
+    }
+    return value;
+}
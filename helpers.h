@@ -1,9 +1,15 @@
 #pragma once
 #include <vector>
+#include <cstddef>
+#include <cstdint>
 #include "Byte.h"
 
 bool get_bit(const std::vector<BYTE>& source, size_t i);
+bool get_bit(const BYTE* source, size_t i);
 void set_bit(std::vector<BYTE>& dest, size_t i, bool val);
+// 8 bytes, most significant first
+void write_uint64(std::vector<BYTE>& dest, uint64_t value);
+uint64_t read_uint64(const BYTE* source);
 template<typename T>
 T get_min(const T& a, const T& b)
 {
@@ -0,0 +1,130 @@
+#include "pch.h"
+#include "mapped_file.h"
+#include <exception>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+mapped_file::mapped_file(const std::string& filename)
+{
+    open(filename);
+}
+
+mapped_file::~mapped_file()
+{
+    close();
+}
+
+#ifdef _WIN32
+void mapped_file::open(const std::string& filename)
+{
+    close();
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        throw std::exception{};
+    }
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size))
+    {
+        CloseHandle(file);
+        throw std::exception{};
+    }
+    file_handle = file;
+    size = static_cast<size_t>(file_size.QuadPart);
+    if (size == 0)
+    {
+        return;
+    }
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping == nullptr)
+    {
+        close();
+        throw std::exception{};
+    }
+    mapping_handle = mapping;
+    data = static_cast<const BYTE*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    if (data == nullptr)
+    {
+        close();
+        throw std::exception{};
+    }
+    WIN32_MEMORY_RANGE_ENTRY range{ const_cast<BYTE*>(data), size };
+    PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+}
+
+void mapped_file::close()
+{
+    if (data != nullptr)
+    {
+        UnmapViewOfFile(data);
+    }
+    if (mapping_handle != nullptr)
+    {
+        CloseHandle(mapping_handle);
+    }
+    if (file_handle != nullptr)
+    {
+        CloseHandle(file_handle);
+    }
+    data = nullptr;
+    size = 0;
+    mapping_handle = nullptr;
+    file_handle = nullptr;
+}
+#else
+void mapped_file::open(const std::string& filename)
+{
+    close();
+    int file = ::open(filename.c_str(), O_RDONLY);
+    if (file < 0)
+    {
+        throw std::exception{};
+    }
+    struct stat file_stat;
+    if (fstat(file, &file_stat) != 0)
+    {
+        ::close(file);
+        throw std::exception{};
+    }
+    size = static_cast<size_t>(file_stat.st_size);
+    if (size == 0)
+    {
+        ::close(file);
+        return;
+    }
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+    ::close(file);
+    if (mapping == MAP_FAILED)
+    {
+        size = 0;
+        throw std::exception{};
+    }
+    madvise(mapping, size, MADV_SEQUENTIAL);
+    madvise(mapping, size, MADV_WILLNEED);
+    data = static_cast<const BYTE*>(mapping);
+}
+
+void mapped_file::close()
+{
+    if (data != nullptr)
+    {
+        munmap(const_cast<BYTE*>(data), size);
+    }
+    data = nullptr;
+    size = 0;
+}
+#endif
+
+const BYTE* mapped_file::get_data() const
+{
+    return data;
+}
+
+size_t mapped_file::get_size() const
+{
+    return size;
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include <string>
+#include "Byte.h"
+
+// Read-only memory mapping of a whole file, hinted for sequential access
+class mapped_file
+{
+private:
+    const BYTE* data = nullptr;
+    size_t size = 0;
+    void* file_handle = nullptr;
+    void* mapping_handle = nullptr;
+public:
+    mapped_file() = default;
+    explicit mapped_file(const std::string& filename);
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+    ~mapped_file();
+
+    void open(const std::string& filename);
+    void close();
+    const BYTE* get_data() const;
+    size_t get_size() const;
+};
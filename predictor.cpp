@@ -0,0 +1,76 @@
+#include "pch.h"
+#include "predictor.h"
+#include <exception>
+
+sample_predictor::sample_predictor(unsigned int type, unsigned int sample_resolution)
+    : type{ type },
+    max_value{ (int64_t{ 1 } << sample_resolution) - 1 }
+{
+    if (type >= predictors_count)
+    {
+        throw std::exception{};
+    }
+}
+
+void sample_predictor::reset(uint32_t reference)
+{
+    history.fill(reference);
+    deltas.fill(0);
+    weights.fill(0);
+}
+
+// weight_1 to weight_3 multiply the last three samples, newest first. Past
+// the first three samples the predictions only read the samples themselves,
+// so they do not depend on each other.
+template<int64_t weight_1, int64_t weight_2, int64_t weight_3>
+void sample_predictor::predict_polynomial(const uint32_t* samples, uint32_t* predictions, size_t count) const
+{
+    size_t head_count = count < history.size() ? count : history.size();
+    for (size_t i = 0; i < head_count; ++i)
+    {
+        // the samples before samples[0] are in history, newest first
+        int64_t sample_1 = i >= 1 ? samples[i - 1] : history[0];
+        int64_t sample_2 = i >= 2 ? samples[i - 2] : history[1 - i];
+        int64_t sample_3 = history[2 - i];
+        predictions[i] = clamp(weight_1 * sample_1 + weight_2 * sample_2 + weight_3 * sample_3);
+    }
+    for (size_t i = head_count; i < count; ++i)
+    {
+        predictions[i] = clamp(weight_1 * samples[i - 1] + weight_2 * samples[i - 2] + weight_3 * samples[i - 3]);
+    }
+}
+
+void sample_predictor::predict_block(const uint32_t* samples, uint32_t* predictions, size_t count)
+{
+    if (type == predictor_polynomial_2)
+    {
+        predict_polynomial<2, -1, 0>(samples, predictions, count);
+    }
+    else if (type == predictor_polynomial_3)
+    {
+        predict_polynomial<3, -3, 1>(samples, predictions, count);
+    }
+    else if (type == predictor_sign_lms)
+    {
+        // every weight update depends on the previous prediction
+        for (size_t i = 0; i < count; ++i)
+        {
+            predictions[i] = clamp(history[0] + get_lms_delta());
+            update_lms(samples[i], predictions[i]);
+            push_history(samples[i]);
+        }
+        return;
+    }
+    else
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            predictions[i] = clamp(i == 0 ? history[0] : samples[i - 1]);
+        }
+    }
+    size_t first_kept = count > history.size() ? count - history.size() : 0;
+    for (size_t i = first_kept; i < count; ++i)
+    {
+        push_history(samples[i]);
+    }
+}
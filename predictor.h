@@ -0,0 +1,122 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include "Byte.h"
+#include "Encoder.h"
+
+// The predictor ID is stored in bits 2-4 of header byte 5
+constexpr BYTE header_predictor_mask = 0b00011100;
+constexpr unsigned int header_predictor_shift = 2;
+
+// Sign-LMS predicts the next sample difference from the last lms_order ones
+// with weights in fixed point, lms_weight_shift fraction bits
+constexpr size_t lms_order = 4;
+constexpr unsigned int lms_weight_shift = 12;
+constexpr int64_t lms_step = 16;
+constexpr int64_t lms_max_weight = int64_t{ 2 } << lms_weight_shift;
+
+// Prediction state over the samples since the last reference sample, for the
+// predictors other than unit delay. The encoder and the decoder run the same
+// code, so their predictions match bit for bit.
+class sample_predictor
+{
+private:
+    unsigned int type = predictor_unit_delay;
+    int64_t max_value = 0;
+    // the last three samples, newest first
+    std::array<int64_t, 3> history{};
+    // the last lms_order differences between samples, newest first
+    std::array<int64_t, lms_order> deltas{};
+    std::array<int64_t, lms_order> weights{};
+public:
+    sample_predictor() = default;
+    sample_predictor(unsigned int type, unsigned int sample_resolution);
+
+    // forgets every earlier sample, reference is the one before the next
+    void reset(uint32_t reference);
+    // prediction of the next sample, within [0, max_value]
+    uint32_t predict() const;
+    // sample is the one predicted last, prediction is what predict returned
+    void update(uint32_t sample, uint32_t prediction);
+    // predict and update over count known samples in turn, for the encoder
+    void predict_block(const uint32_t* samples, uint32_t* predictions, size_t count);
+private:
+    uint32_t clamp(int64_t prediction) const;
+    int64_t get_lms_delta() const;
+    void update_lms(uint32_t sample, uint32_t prediction);
+    void push_history(uint32_t sample);
+    template<int64_t weight_1, int64_t weight_2, int64_t weight_3>
+    void predict_polynomial(const uint32_t* samples, uint32_t* predictions, size_t count) const;
+};
+
+inline uint32_t sample_predictor::clamp(int64_t prediction) const
+{
+    prediction = prediction < 0 ? 0 : prediction;
+    return static_cast<uint32_t>(prediction > max_value ? max_value : prediction);
+}
+
+inline int64_t sample_predictor::get_lms_delta() const
+{
+    int64_t delta = 0;
+    for (size_t j = 0; j < lms_order; ++j)
+    {
+        delta += weights[j] * deltas[j];
+    }
+    return delta >> lms_weight_shift;
+}
+
+inline uint32_t sample_predictor::predict() const
+{
+    int64_t prediction;
+    if (type == predictor_polynomial_2)
+    {
+        prediction = 2 * history[0] - history[1];
+    }
+    else if (type == predictor_polynomial_3)
+    {
+        prediction = 3 * history[0] - 3 * history[1] + history[2];
+    }
+    else if (type == predictor_sign_lms)
+    {
+        prediction = history[0] + get_lms_delta();
+    }
+    else
+    {
+        prediction = history[0];
+    }
+    return clamp(prediction);
+}
+
+inline void sample_predictor::update_lms(uint32_t sample, uint32_t prediction)
+{
+    int64_t error_sign = (sample > prediction) - (sample < prediction);
+    for (size_t j = 0; j < lms_order; ++j)
+    {
+        int64_t delta_sign = (deltas[j] > 0) - (deltas[j] < 0);
+        int64_t weight = weights[j] + lms_step * error_sign * delta_sign;
+        weight = weight > lms_max_weight ? lms_max_weight : weight;
+        weights[j] = weight < -lms_max_weight ? -lms_max_weight : weight;
+    }
+    for (size_t j = lms_order - 1; j > 0; --j)
+    {
+        deltas[j] = deltas[j - 1];
+    }
+    deltas[0] = int64_t{ sample } - history[0];
+}
+
+inline void sample_predictor::push_history(uint32_t sample)
+{
+    history[2] = history[1];
+    history[1] = history[0];
+    history[0] = sample;
+}
+
+inline void sample_predictor::update(uint32_t sample, uint32_t prediction)
+{
+    if (type == predictor_sign_lms)
+    {
+        update_lms(sample, prediction);
+    }
+    push_history(sample);
+}
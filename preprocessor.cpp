@@ -2,23 +2,96 @@
 #include "preprocessor.h"
 #include <cstdlib>
 #include "helpers.h"
+#include "cpu_features.h"
 
-uint32_t unit_delay_preprocesson::map(int64_t error)
+// The prediction error is folded into [0, max_value] without branches:
+// errors within theta of zero alternate 0, -1, 1, -2, ..., the larger ones
+// follow in order of magnitude.
+static uint32_t map(uint32_t sample, uint32_t preceeding_sample, uint32_t max_value)
 {
-	int64_t theta = get_min(preceeding_sample, max_value - preceeding_sample);
-	if (error >= 0 && error <= theta)
+	uint32_t theta = get_min(preceeding_sample, max_value - preceeding_sample);
+	uint32_t negative = sample < preceeding_sample;
+	uint32_t magnitude = negative ? preceeding_sample - sample : sample - preceeding_sample;
+	return magnitude <= theta ? 2 * magnitude - negative : theta + magnitude;
+}
+
+static void map_block_scalar(const uint32_t* samples, uint32_t preceeding_sample, uint32_t max_value, uint32_t* preprocessed, size_t count)
+{
+	for (size_t i = 0; i < count; ++i)
 	{
-		return 2 * error;
+		preprocessed[i] = map(samples[i], preceeding_sample, max_value);
+		preceeding_sample = samples[i];
 	}
-	if (error >= -theta && error < 0)
+}
+
+// The prediction of every sample is the sample before it, so all lanes are
+// independent; only the first sample needs the previous block.
+#ifdef SIMD_X86
+TARGET_AVX2 static void map_block_avx2(const uint32_t* samples, uint32_t preceeding_sample, uint32_t max_value, uint32_t* preprocessed, size_t count)
+{
+	if (count == 0)
+	{
+		return;
+	}
+	preprocessed[0] = map(samples[0], preceeding_sample, max_value);
+	const __m256i max_values = _mm256_set1_epi32(max_value);
+	size_t i = 1;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256i sample = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(samples + i));
+		__m256i preceeding = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(samples + i - 1));
+		__m256i theta = _mm256_min_epu32(preceeding, _mm256_sub_epi32(max_values, preceeding));
+		__m256i larger = _mm256_max_epu32(sample, preceeding);
+		__m256i magnitude = _mm256_sub_epi32(larger, _mm256_min_epu32(sample, preceeding));
+		// all ones where the error is negative
+		__m256i negative = _mm256_andnot_si256(_mm256_cmpeq_epi32(larger, sample), _mm256_set1_epi32(-1));
+		__m256i near = _mm256_add_epi32(_mm256_slli_epi32(magnitude, 1), negative);
+		__m256i far = _mm256_add_epi32(theta, magnitude);
+		__m256i is_near = _mm256_cmpeq_epi32(_mm256_min_epu32(magnitude, theta), magnitude);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(preprocessed + i), _mm256_blendv_epi8(far, near, is_near));
+	}
+	map_block_scalar(samples + i, samples[i - 1], max_value, preprocessed + i, count - i);
+}
+
+TARGET_SSE41 static void map_block_sse41(const uint32_t* samples, uint32_t preceeding_sample, uint32_t max_value, uint32_t* preprocessed, size_t count)
+{
+	if (count == 0)
 	{
-		return (2 * std::abs(error)) - 1;
+		return;
 	}
-	if (error > 0)
+	preprocessed[0] = map(samples[0], preceeding_sample, max_value);
+	const __m128i max_values = _mm_set1_epi32(max_value);
+	size_t i = 1;
+	for (; i + 4 <= count; i += 4)
 	{
-		return theta + error;
+		__m128i sample = _mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + i));
+		__m128i preceeding = _mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + i - 1));
+		__m128i theta = _mm_min_epu32(preceeding, _mm_sub_epi32(max_values, preceeding));
+		__m128i larger = _mm_max_epu32(sample, preceeding);
+		__m128i magnitude = _mm_sub_epi32(larger, _mm_min_epu32(sample, preceeding));
+		__m128i negative = _mm_andnot_si128(_mm_cmpeq_epi32(larger, sample), _mm_set1_epi32(-1));
+		__m128i near = _mm_add_epi32(_mm_slli_epi32(magnitude, 1), negative);
+		__m128i far = _mm_add_epi32(theta, magnitude);
+		__m128i is_near = _mm_cmpeq_epi32(_mm_min_epu32(magnitude, theta), magnitude);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(preprocessed + i), _mm_blendv_epi8(far, near, is_near));
 	}
-	return theta - error;
+	map_block_scalar(samples + i, samples[i - 1], max_value, preprocessed + i, count - i);
+}
+#endif
+
+static unit_delay_kernel select_unit_delay_kernel()
+{
+#ifdef SIMD_X86
+	if (cpu_supports_avx2())
+	{
+		return map_block_avx2;
+	}
+	if (cpu_supports_sse41())
+	{
+		return map_block_sse41;
+	}
+#endif
+	return map_block_scalar;
 }
 
 uint32_t unit_delay_preprocesson::get_reference()
@@ -26,6 +99,11 @@ uint32_t unit_delay_preprocesson::get_reference()
 	return preceeding_sample;
 }
 
+void unit_delay_preprocesson::reset(uint32_t reference)
+{
+	preceeding_sample = reference;
+}
+
 unit_delay_preprocesson::unit_delay_preprocesson(unsigned int sample_size)
 	:sample_size{ sample_size }
 {
@@ -34,14 +112,66 @@ unit_delay_preprocesson::unit_delay_preprocesson(unsigned int sample_size)
 		throw std::exception{};
 	}
 	max_value = (1ll << sample_size) - 1;
+	static const unit_delay_kernel kernel = select_unit_delay_kernel();
+	map_block = kernel;
 }
 
 uint32_t unit_delay_preprocesson::get_preprocessed(uint32_t sample)
 {
-	int64_t signed_sample = sample;
-	int64_t error = signed_sample - preceeding_sample;
-	uint32_t mapped_error = map(error);
+	uint32_t mapped_error = map(sample, preceeding_sample, max_value);
 	preceeding_sample = sample;
 	return mapped_error;
 }
 
+void unit_delay_preprocesson::preprocess(const uint32_t* samples, uint32_t* preprocessed, size_t count)
+{
+	if (count == 0)
+	{
+		return;
+	}
+	map_block(samples, preceeding_sample, max_value, preprocessed, count);
+	preceeding_sample = samples[count - 1];
+}
+
+predicting_preprocessor::predicting_preprocessor(unsigned int predictor_type, unsigned int sample_size)
+	: predictor{ predictor_type, sample_size }
+{
+	if (sample_size == 0 || sample_size > 32)
+	{
+		throw std::exception{};
+	}
+	max_value = static_cast<uint32_t>((1ull << sample_size) - 1);
+}
+
+uint32_t predicting_preprocessor::get_preprocessed(uint32_t sample)
+{
+	uint32_t prediction = predictor.predict();
+	predictor.update(sample, prediction);
+	last_sample = sample;
+	return map(sample, prediction, max_value);
+}
+
+void predicting_preprocessor::preprocess(const uint32_t* samples, uint32_t* preprocessed, size_t count)
+{
+	// the predictions go to preprocessed first and are mapped in place
+	predictor.predict_block(samples, preprocessed, count);
+	for (size_t i = 0; i < count; ++i)
+	{
+		preprocessed[i] = map(samples[i], preprocessed[i], max_value);
+	}
+	if (count != 0)
+	{
+		last_sample = samples[count - 1];
+	}
+}
+
+uint32_t predicting_preprocessor::get_reference()
+{
+	return last_sample;
+}
+
+void predicting_preprocessor::reset(uint32_t reference)
+{
+	predictor.reset(reference);
+	last_sample = reference;
+}
@@ -1,27 +1,54 @@
 #pragma once
 #include <cstdint>
+#include <cstddef>
 #include <cstdlib>
 #include <exception>
+#include "predictor.h"
 
 class preprocessor
 {
 public:
     virtual uint32_t get_preprocessed(uint32_t sample) = 0;
+    // same as get_preprocessed on every sample in order, one call per block
+    virtual void preprocess(const uint32_t* samples, uint32_t* preprocessed, size_t count) = 0;
     virtual uint32_t get_reference() = 0;
+    // starts over from a reference sample, nothing before it is used again
+    virtual void reset(uint32_t reference) = 0;
     virtual ~preprocessor() = default;
 };
 
-class unit_delay_preprocesson : public preprocessor
+// Maps the count samples following preceeding_sample into preprocessed
+using unit_delay_kernel = void (*)(const uint32_t* samples, uint32_t preceeding_sample, uint32_t max_value, uint32_t* preprocessed, size_t count);
+
+class unit_delay_preprocesson final : public preprocessor
 {
 private:
 	uint32_t max_value;
     uint32_t min_value = 0;
 	unsigned int sample_size;
     uint32_t preceeding_sample = 0;
-    uint32_t map(int64_t error);
+    unit_delay_kernel map_block;
 public:
     unit_delay_preprocesson(unsigned int sample_size);
     uint32_t get_preprocessed(uint32_t sample) override;
+    void preprocess(const uint32_t* samples, uint32_t* preprocessed, size_t count) override;
     uint32_t get_reference() override;
+    void reset(uint32_t reference) override;
 	~unit_delay_preprocesson() override = default;
 };
+
+// Polynomial and sign-LMS predictors, the error is mapped as for unit delay
+// with the prediction in place of the previous sample
+class predicting_preprocessor final : public preprocessor
+{
+private:
+    uint32_t max_value;
+    uint32_t last_sample = 0;
+    sample_predictor predictor;
+public:
+    predicting_preprocessor(unsigned int predictor_type, unsigned int sample_size);
+    uint32_t get_preprocessed(uint32_t sample) override;
+    void preprocess(const uint32_t* samples, uint32_t* preprocessed, size_t count) override;
+    uint32_t get_reference() override;
+    void reset(uint32_t reference) override;
+};
@@ -1,8 +1,92 @@
 #include "pch.h"
 #include "reverse_preprocessor.h"
 #include "helpers.h"
+#include "cpu_features.h"
+#include <bit>
+
+// Inverse of the unit-delay mapping without branches. Values up to 2 * theta
+// are zigzag coded errors, the larger ones move away from the nearer bound.
+static uint32_t reverse(uint32_t preprocessed, uint32_t reference, uint32_t max_value)
+{
+	uint32_t theta = get_min(reference, max_value - reference);
+	uint32_t near = (preprocessed >> 1) ^ (0u - (preprocessed & 1));
+	uint32_t far = preprocessed - theta;
+	far = reference > max_value / 2 ? 0u - far : far;
+	// arithmetic is modulo 2^32, the sum is exact for valid input
+	return reference + (preprocessed > uint64_t{ theta } * 2 ? far : near);
+}
+
+static uint32_t reverse_block_scalar(const uint32_t* preprocessed, uint32_t reference, uint32_t max_value, uint32_t* values, size_t count)
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		reference = reverse(preprocessed[i], reference, max_value);
+		values[i] = reference;
+	}
+	return reference;
+}
+
+// While no error reaches past theta every sample is the previous one plus its
+// zigzag decoded error, so four samples are a prefix sum. The sums are checked
+// against theta of the samples they follow afterwards, the first sample that
+// fails is reconstructed on its own and the vector loop resumes after it.
+#ifdef SIMD_X86
+TARGET_SSE41 static uint32_t reverse_block_sse41(const uint32_t* preprocessed, uint32_t reference, uint32_t max_value, uint32_t* values, size_t count)
+{
+	const __m128i max_values = _mm_set1_epi32(max_value);
+	const __m128i ones = _mm_set1_epi32(1);
+	size_t i = 0;
+	while (i + 4 <= count)
+	{
+		__m128i mapped = _mm_loadu_si128(reinterpret_cast<const __m128i*>(preprocessed + i));
+		__m128i errors = _mm_xor_si128(_mm_srli_epi32(mapped, 1), _mm_sub_epi32(_mm_setzero_si128(), _mm_and_si128(mapped, ones)));
+		errors = _mm_add_epi32(errors, _mm_slli_si128(errors, 4));
+		errors = _mm_add_epi32(errors, _mm_slli_si128(errors, 8));
+		__m128i previous_last = _mm_set1_epi32(reference);
+		__m128i samples = _mm_add_epi32(errors, previous_last);
+		__m128i previous = _mm_alignr_epi8(samples, previous_last, 12);
+		__m128i theta = _mm_min_epu32(previous, _mm_sub_epi32(max_values, previous));
+		// saturated, theta is above max_value / 2 only for corrupt input
+		__m128i twice_theta = _mm_or_si128(_mm_add_epi32(theta, theta), _mm_srai_epi32(theta, 31));
+		__m128i near = _mm_cmpeq_epi32(_mm_min_epu32(mapped, twice_theta), mapped);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(values + i), samples);
+		unsigned int near_mask = _mm_movemask_ps(_mm_castsi128_ps(near));
+		if (near_mask == 0b1111)
+		{
+			reference = static_cast<uint32_t>(_mm_extract_epi32(samples, 3));
+			i += 4;
+			continue;
+		}
+		unsigned int near_count = std::countr_one(near_mask);
+		reference = near_count == 0 ? reference : values[i + near_count - 1];
+		i += near_count;
+		reference = reverse(preprocessed[i], reference, max_value);
+		values[i] = reference;
+		++i;
+	}
+	return reverse_block_scalar(preprocessed + i, reference, max_value, values + i, count - i);
+}
+#endif
+
+static reverse_kernel select_reverse_kernel()
+{
+#ifdef SIMD_X86
+	if (cpu_supports_sse41())
+	{
+		return reverse_block_sse41;
+	}
+#endif
+	return reverse_block_scalar;
+}
+
+reverse_preprocessor::reverse_preprocessor()
+{
+	static const reverse_kernel kernel = select_reverse_kernel();
+	reverse_block = kernel;
+}
 
 reverse_preprocessor::reverse_preprocessor(unsigned int sample_resolution)
+	: reverse_preprocessor()
 {
 	set_sample_resolution(sample_resolution);
 }
@@ -12,33 +96,51 @@ void reverse_preprocessor::set_sample_resolution(unsigned int sample_resolution)
 	max_value = (1ull << sample_resolution) - 1;
 }
 
+void reverse_preprocessor::set_predictor(unsigned int predictor_type)
+{
+	this->predictor_type = predictor_type;
+	predictor = sample_predictor{ predictor_type, static_cast<unsigned int>(std::bit_width(max_value)) };
+}
+
+unsigned int reverse_preprocessor::get_predictor() const
+{
+	return predictor_type;
+}
+
 void reverse_preprocessor::set_reference(uint32_t reference)
 {
 	this->reference = reference;
+	predictor.reset(reference);
+}
+
+uint32_t reverse_preprocessor::get_reference() const
+{
+	return reference;
 }
 
 uint32_t reverse_preprocessor::get_value(uint32_t preprocessed)
 {
-	reference = _get_value(preprocessed);
+	if (predictor_type == predictor_unit_delay)
+	{
+		reference = reverse(preprocessed, reference, max_value);
+		return reference;
+	}
+	uint32_t prediction = predictor.predict();
+	reference = reverse(preprocessed, prediction, max_value);
+	predictor.update(reference, prediction);
 	return reference;
 }
 
-uint32_t reverse_preprocessor::_get_value(uint32_t preprocessed)
+void reverse_preprocessor::get_values(const uint32_t* preprocessed, uint32_t* values, size_t count)
 {
-	uint64_t theta = get_min(reference, max_value - reference);
-	if (preprocessed > theta * 2)
+	if (predictor_type == predictor_unit_delay)
 	{
-		preprocessed -= theta;
-		if (reference > max_value / 2)
-		{
-			return reference - preprocessed;
-		}
-		return reference + preprocessed;
+		reference = reverse_block(preprocessed, reference, max_value, values, count);
+		return;
 	}
-	if (preprocessed % 2 == 0)
+	// every prediction depends on the sample before, there is no prefix sum here
+	for (size_t i = 0; i < count; ++i)
 	{
-		return reference + preprocessed / 2;
+		values[i] = get_value(preprocessed[i]);
 	}
-	preprocessed += 1;
-	return reference - preprocessed / 2;
 }
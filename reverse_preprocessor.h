@@ -1,18 +1,30 @@
 #pragma once
 #include <cstdint>
+#include <cstddef>
+#include "predictor.h"
+
+// Reconstructs count samples from their mapped prediction errors, starting
+// from reference; returns the last sample
+using reverse_kernel = uint32_t (*)(const uint32_t* preprocessed, uint32_t reference, uint32_t max_value, uint32_t* values, size_t count);
 
 class reverse_preprocessor
 {
 private:
 	uint32_t reference;
 	uint32_t max_value = 0;
+	reverse_kernel reverse_block;
+	unsigned int predictor_type = predictor_unit_delay;
+	sample_predictor predictor;
 public:
-	reverse_preprocessor() = default;
+	reverse_preprocessor();
 	reverse_preprocessor(unsigned int sample_resolution);
 	void set_sample_resolution(unsigned int sample_resolution);
+	// takes effect from the next set_reference
+	void set_predictor(unsigned int predictor_type);
+	unsigned int get_predictor() const;
 	void set_reference(uint32_t reference);
+	uint32_t get_reference() const;
 	uint32_t get_value(uint32_t preprocessed);
-private:
-	uint32_t _get_value(uint32_t preprocessed);
+	// same as get_value on every sample in order
+	void get_values(const uint32_t* preprocessed, uint32_t* values, size_t count);
 };
-
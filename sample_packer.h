@@ -0,0 +1,29 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include "Byte.h"
+
+// Writes the low sample_resolution bits of sample MSB-first starting at bit
+// bit_i of dest. The bits before bit_i in its byte are kept and the rest of
+// the last byte touched is cleared, so samples have to be written in order.
+inline void pack_sample(BYTE* dest, size_t bit_i, uint32_t sample, unsigned int sample_resolution)
+{
+	BYTE* first = dest + bit_i / 8;
+	unsigned int shift = bit_i % 8;
+	if (shift == 0 && sample_resolution % 8 == 0)
+	{
+		// byte-aligned samples are stored big-endian as they are
+		for (unsigned int i = sample_resolution; i > 0; i -= 8)
+		{
+			*first++ = static_cast<BYTE>(sample >> (i - 8));
+		}
+		return;
+	}
+	uint64_t window = (uint64_t{ sample } << (64 - sample_resolution)) >> shift;
+	window |= uint64_t{ static_cast<BYTE>(*first & (0xFF00 >> shift)) } << 56;
+	unsigned int bytes_count = (shift + sample_resolution + 7) / 8;
+	for (unsigned int i = 0; i < bytes_count; ++i)
+	{
+		first[i] = static_cast<BYTE>(window >> (56 - i * 8));
+	}
+}
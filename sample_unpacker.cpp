@@ -0,0 +1,108 @@
+#include "pch.h"
+#include "sample_unpacker.h"
+#include "helpers.h"
+
+template<unsigned int bytes_count>
+static uint64_t load_big_endian(const BYTE* data)
+{
+    uint64_t value = 0;
+    for (unsigned int i = 0; i < bytes_count; ++i)
+    {
+        value = (value << 8) | data[i];
+    }
+    return value;
+}
+
+static size_t unpack_bits(const BYTE* data, size_t data_size, unsigned int sample_resolution, uint32_t* samples, size_t samples_count)
+{
+    uint32_t mask = 0xFFFFFFFFu >> (32 - sample_resolution);
+    uint64_t accumulator = 0;
+    unsigned int accumulator_size = 0;
+    size_t byte_i = 0;
+    size_t i = 0;
+    for (; i < samples_count; ++i)
+    {
+        while (accumulator_size < sample_resolution && byte_i < data_size)
+        {
+            accumulator = (accumulator << 8) | data[byte_i++];
+            accumulator_size += 8;
+        }
+        if (accumulator_size == 0)
+        {
+            break;
+        }
+        if (accumulator_size >= sample_resolution)
+        {
+            accumulator_size -= sample_resolution;
+            samples[i] = (accumulator >> accumulator_size) & mask;
+        }
+        else
+        {
+            samples[i] = (accumulator << (sample_resolution - accumulator_size)) & mask;
+            accumulator_size = 0;
+        }
+    }
+    size_t covered_count = i;
+    for (; i < samples_count; ++i)
+    {
+        samples[i] = 0;
+    }
+    return covered_count;
+}
+
+template<unsigned int sample_resolution>
+static size_t unpack_aligned(const BYTE* data, size_t data_size, unsigned int, uint32_t* samples, size_t samples_count)
+{
+    constexpr unsigned int sample_bytes = sample_resolution / 8;
+    size_t whole_count = get_min(data_size / sample_bytes, samples_count);
+    for (size_t i = 0; i < whole_count; ++i)
+    {
+        samples[i] = static_cast<uint32_t>(load_big_endian<sample_bytes>(data + i * sample_bytes));
+    }
+    size_t whole_bytes = whole_count * sample_bytes;
+    return whole_count + unpack_bits(data + whole_bytes, data_size - whole_bytes, sample_resolution, samples + whole_count, samples_count - whole_count);
+}
+
+// four samples of an even resolution fill sample_resolution / 2 whole bytes
+template<unsigned int sample_resolution>
+static size_t unpack_packed(const BYTE* data, size_t data_size, unsigned int, uint32_t* samples, size_t samples_count)
+{
+    constexpr unsigned int group_bytes = sample_resolution / 2;
+    constexpr uint32_t mask = (1u << sample_resolution) - 1;
+    size_t groups_count = get_min(data_size / group_bytes, samples_count / 4);
+    for (size_t i = 0; i < groups_count; ++i)
+    {
+        uint64_t group = load_big_endian<group_bytes>(data + i * group_bytes);
+        uint32_t* group_samples = samples + i * 4;
+        group_samples[0] = (group >> (sample_resolution * 3)) & mask;
+        group_samples[1] = (group >> (sample_resolution * 2)) & mask;
+        group_samples[2] = (group >> sample_resolution) & mask;
+        group_samples[3] = group & mask;
+    }
+    size_t whole_count = groups_count * 4;
+    size_t whole_bytes = groups_count * group_bytes;
+    return whole_count + unpack_bits(data + whole_bytes, data_size - whole_bytes, sample_resolution, samples + whole_count, samples_count - whole_count);
+}
+
+unpack_kernel get_unpack_kernel(unsigned int sample_resolution)
+{
+    switch (sample_resolution)
+    {
+    case 8:
+        return unpack_aligned<8>;
+    case 10:
+        return unpack_packed<10>;
+    case 12:
+        return unpack_packed<12>;
+    case 14:
+        return unpack_packed<14>;
+    case 16:
+        return unpack_aligned<16>;
+    case 24:
+        return unpack_aligned<24>;
+    case 32:
+        return unpack_aligned<32>;
+    default:
+        return unpack_bits;
+    }
+}
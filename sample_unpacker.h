@@ -0,0 +1,13 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include "Byte.h"
+
+// Unpacks samples of sample_resolution bits stored back to back MSB-first.
+// A trailing partial sample is padded with zero bits and the samples past the
+// data are zero. Returns how many samples the data covers.
+using unpack_kernel = size_t (*)(const BYTE* data, size_t data_size, unsigned int sample_resolution, uint32_t* samples, size_t samples_count);
+
+// Byte-aligned resolutions are plain big-endian loads, 10, 12 and 14 bits are
+// unpacked four samples per word, the rest bit by bit through an accumulator.
+unpack_kernel get_unpack_kernel(unsigned int sample_resolution);
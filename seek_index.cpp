@@ -0,0 +1,48 @@
+#include "pch.h"
+#include "seek_index.h"
+#include "helpers.h"
+#include <exception>
+
+std::vector<BYTE> write_seek_index(const std::vector<seek_index_entry>& entries)
+{
+    std::vector<BYTE> trailer;
+    trailer.reserve(entries.size() * seek_index_entry_size + 8);
+    for (const auto& entry : entries)
+    {
+        write_uint64(trailer, entry.bit_offset);
+        write_uint64(trailer, entry.first_sample);
+    }
+    write_uint64(trailer, entries.size());
+    return trailer;
+}
+
+std::vector<seek_index_entry> read_seek_index(const BYTE* data, size_t& data_size)
+{
+    if (data_size < 8)
+    {
+        throw std::exception{};
+    }
+    uint64_t entries_count = read_uint64(data + data_size - 8);
+    if (entries_count > (data_size - 8) / seek_index_entry_size)
+    {
+        throw std::exception{};
+    }
+    size_t encoded_size = data_size - 8 - entries_count * seek_index_entry_size;
+    const BYTE* trailer = data + encoded_size;
+
+    std::vector<seek_index_entry> entries(entries_count);
+    for (size_t i = 0; i < entries_count; ++i)
+    {
+        entries[i].bit_offset = read_uint64(trailer + i * seek_index_entry_size);
+        entries[i].first_sample = read_uint64(trailer + i * seek_index_entry_size + 8);
+        bool ordered = i == 0
+            ? entries[i].bit_offset == 0 && entries[i].first_sample == 0
+            : entries[i].bit_offset > entries[i - 1].bit_offset && entries[i].first_sample > entries[i - 1].first_sample;
+        if (!ordered || entries[i].bit_offset >= encoded_size * 8)
+        {
+            throw std::exception{};
+        }
+    }
+    data_size = encoded_size;
+    return entries;
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include "Byte.h"
+
+// Optional trailer written after the encoded data, outside of the range the
+// header's sample count covers, so decoders without index support ignore it.
+// It holds one entry per reference sample segment followed by the entries
+// count, all big-endian. The header flags its presence in byte 5.
+constexpr BYTE header_flag_seek_index = 0b00000001;
+// Reference samples are placed by the encoder and listed in the seek index
+// besides the ones every reference interval blocks.
+constexpr BYTE header_flag_adaptive_reference = 0b00000010;
+constexpr size_t seek_index_entry_size = 16;
+
+struct seek_index_entry
+{
+    // from the first bit after the header
+    uint64_t bit_offset;
+    uint64_t first_sample;
+};
+
+std::vector<BYTE> write_seek_index(const std::vector<seek_index_entry>& entries);
+// data follows the header and ends with the trailer, data_size is reduced to
+// the size of the encoded data alone
+std::vector<seek_index_entry> read_seek_index(const BYTE* data, size_t& data_size);
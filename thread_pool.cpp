@@ -0,0 +1,146 @@
+#include "pch.h"
+#include "thread_pool.h"
+#include "helpers.h"
+
+thread_pool::thread_pool(unsigned int threads_count)
+{
+    if (threads_count == 0)
+    {
+        threads_count = std::thread::hardware_concurrency();
+    }
+    for (unsigned int i = 1; i < threads_count; ++i)
+    {
+        threads.emplace_back([this] { work(); });
+    }
+}
+
+thread_pool::~thread_pool()
+{
+    {
+        std::lock_guard<std::mutex> lock{ jobs_mutex };
+        stopping = true;
+    }
+    job_added.notify_all();
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+}
+
+void thread_pool::work()
+{
+    while (true)
+    {
+        std::shared_ptr<job> current;
+        {
+            std::unique_lock<std::mutex> lock{ jobs_mutex };
+            job_added.wait(lock, [this] { return stopping || !jobs.empty(); });
+            if (stopping)
+            {
+                return;
+            }
+            current = jobs.front();
+            // every task is taken already, the remaining ones are running
+            if (current->next_task >= current->tasks_count)
+            {
+                jobs.pop_front();
+                continue;
+            }
+        }
+        work_on(*current);
+    }
+}
+
+void thread_pool::work_on(job& current)
+{
+    size_t done_count = 0;
+    std::exception_ptr error;
+    for (size_t i = current.next_task++; i < current.tasks_count; i = current.next_task++)
+    {
+        try
+        {
+            current.task(i);
+        }
+        catch (...)
+        {
+            if (!error)
+            {
+                error = std::current_exception();
+            }
+        }
+        ++done_count;
+    }
+    if (done_count == 0)
+    {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock{ jobs_mutex };
+        current.done_count += done_count;
+        if (error && !current.error)
+        {
+            current.error = error;
+        }
+    }
+    job_done.notify_all();
+}
+
+void thread_pool::run(size_t tasks_count, const std::function<void(size_t)>& task)
+{
+    if (tasks_count == 0)
+    {
+        return;
+    }
+    auto current = std::make_shared<job>();
+    current->task = task;
+    current->tasks_count = tasks_count;
+    if (tasks_count > 1 && !threads.empty())
+    {
+        {
+            std::lock_guard<std::mutex> lock{ jobs_mutex };
+            jobs.push_back(current);
+        }
+        job_added.notify_all();
+    }
+    work_on(*current);
+
+    std::unique_lock<std::mutex> lock{ jobs_mutex };
+    job_done.wait(lock, [&current] { return current->done_count == current->tasks_count; });
+    if (current->error)
+    {
+        std::rethrow_exception(current->error);
+    }
+}
+
+void thread_pool::run_ranges(size_t items_count, const std::function<void(size_t, size_t)>& task)
+{
+    size_t ranges_count = get_min<size_t>(items_count, size_t{ get_threads_count() } * 4);
+    run(ranges_count, [&](size_t i) {
+        task(items_count * i / ranges_count, items_count * (i + 1) / ranges_count);
+    });
+}
+
+unsigned int thread_pool::get_threads_count() const
+{
+    return static_cast<unsigned int>(threads.size()) + 1;
+}
+
+static std::mutex shared_mutex;
+static thread_pool* shared = nullptr;
+
+thread_pool& thread_pool::get_shared()
+{
+    std::lock_guard<std::mutex> lock{ shared_mutex };
+    if (shared == nullptr)
+    {
+        shared = new thread_pool;
+    }
+    return *shared;
+}
+
+void thread_pool::stop_shared()
+{
+    std::lock_guard<std::mutex> lock{ shared_mutex };
+    delete shared;
+    shared = nullptr;
+}
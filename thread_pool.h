@@ -0,0 +1,56 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <atomic>
+#include <exception>
+
+// Fixed set of worker threads running indexed jobs. The thread calling run
+// works on its own job too, so a task may call run again without deadlock.
+class thread_pool
+{
+private:
+    struct job
+    {
+        std::function<void(size_t)> task;
+        size_t tasks_count = 0;
+        std::atomic<size_t> next_task{ 0 };
+        size_t done_count = 0;
+        std::exception_ptr error;
+    };
+
+    std::vector<std::thread> threads;
+    std::deque<std::shared_ptr<job>> jobs;
+    std::mutex jobs_mutex;
+    std::condition_variable job_added;
+    std::condition_variable job_done;
+    bool stopping = false;
+
+    void work();
+    void work_on(job& current);
+public:
+    // threads_count counts the calling thread, 0 means one per hardware thread
+    explicit thread_pool(unsigned int threads_count = 0);
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+    ~thread_pool();
+
+    // runs task(i) for every i in [0, tasks_count) and waits for all of them,
+    // the first exception thrown by a task is rethrown here
+    void run(size_t tasks_count, const std::function<void(size_t)>& task);
+    // runs task(first, last) over ranges that split [0, items_count) into a
+    // few per thread, for items too small to be a task each
+    void run_ranges(size_t items_count, const std::function<void(size_t, size_t)>& task);
+    unsigned int get_threads_count() const;
+
+    // Pool of one thread per hardware thread, created on first use. Static
+    // destruction never joins its threads, which could deadlock under the
+    // Windows loader lock, stop_shared joins them and get_shared starts a
+    // new pool after it.
+    static thread_pool& get_shared();
+    static void stop_shared();
+};